@@ -0,0 +1,18 @@
+#ifndef LLVM_TRANSFORMS_IVSTRENGTHREDUCTION_H
+#define LLVM_TRANSFORMS_IVSTRENGTHREDUCTION_H
+
+#include "llvm/Analysis/LoopAnalysisManager.h"
+#include "llvm/Transforms/Scalar/LoopPassManager.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+
+namespace llvm {
+
+class IVStrengthReduction : public PassInfoMixin<IVStrengthReduction> {
+public:
+  PreservedAnalyses run(Loop &L, LoopAnalysisManager &LAM,
+                        LoopStandardAnalysisResults &LAR, LPMUpdater &LU);
+};
+
+} // namespace llvm
+
+#endif // LLVM_TRANSFORMS_IVSTRENGTHREDUCTION_H
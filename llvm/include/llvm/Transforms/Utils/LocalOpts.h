@@ -9,6 +9,7 @@ namespace llvm {
 class LocalOpts : public PassInfoMixin<LocalOpts> {
 public:
         PreservedAnalyses run(Module &M, ModuleAnalysisManager &AM);
+        PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM);
 };
 
 } // namespace llvm
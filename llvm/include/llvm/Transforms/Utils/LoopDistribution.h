@@ -0,0 +1,16 @@
+#ifndef LLVM_TRANSFORMS_LOOPDISTRIBUTION_H
+#define LLVM_TRANSFORMS_LOOPDISTRIBUTION_H
+
+#include "llvm/IR/PassManager.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/DependenceAnalysis.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/Analysis/LoopInfo.h"
+
+namespace llvm {
+	class LoopDistribution : public PassInfoMixin<LoopDistribution> {
+		public:
+		PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM);
+	};
+} // namespace llvm
+#endif // LLVM_TRANSFORMS_LOOPDISTRIBUTION_H
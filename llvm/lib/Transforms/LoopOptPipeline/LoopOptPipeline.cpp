@@ -0,0 +1,149 @@
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/PassInstrumentation.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Scalar/LoopPassManager.h"
+#include "llvm/Transforms/Utils/LocalOpts.h"
+#include "llvm/Transforms/Utils/LoopFusion.h"
+#include "llvm/Transforms/Utils/LoopInvariantCodeMotion.h"
+using namespace llvm;
+
+#define DEBUG_TYPE "my-loop-opt"
+
+STATISTIC(NumIterations, "Number of my-loop-opt iterations that changed the module");
+STATISTIC(NumIterationLimit, "Number of times my-loop-opt stopped at the iteration limit");
+
+static cl::opt<unsigned> MaxIterations(
+    "my-loop-opt-max-iterations", cl::init(4), cl::Hidden,
+    cl::desc("Maximum number of times the my-loop-opt pipeline is repeated "
+             "while its passes keep changing the module"));
+
+static cl::opt<bool> EnableLoopOpt(
+    "enable-my-loop-opt", cl::init(false), cl::Hidden,
+    cl::desc("Add localopts, my-licm and my-loop-fusion to the default "
+             "optimization pipelines"));
+
+namespace {
+// Pipeline my-loop-opt: localopts -> my-licm -> my-loop-fusion -> my-licm, ripetuta
+// finché uno dei passi modifica il modulo.
+class LoopOptPipeline : public PassInfoMixin<LoopOptPipeline> {
+public:
+  PreservedAnalyses run(Module &M, ModuleAnalysisManager &AM);
+};
+} // namespace
+
+template <typename PassT, typename IRUnitT>
+bool runAndInvalidate(PassT &Pass, IRUnitT &IR, AnalysisManager<IRUnitT> &AM) {
+  /*
+  Esegue un passo su IR (il modulo o una function) come farebbe la PassManager: chiama i
+  callback di PassInstrumentation prima e dopo il passo, così valgono optnone,
+  -opt-bisect-limit, -print-after e -time-passes, e invalida le analisi che il passo non ha
+  preservato. Restituisce true se il passo ha modificato IR.
+  */
+  PassInstrumentation PI = AM.template getResult<PassInstrumentationAnalysis>(IR);
+  if (!PI.runBeforePass<IRUnitT>(Pass, IR))
+    return false;
+
+  PreservedAnalyses PA = Pass.run(IR, AM);
+  PI.runAfterPass<IRUnitT>(Pass, IR, PA);
+  AM.invalidate(IR, PA);
+  return !PA.areAllPreserved();
+}
+
+PreservedAnalyses LoopOptPipeline::run(Module &M, ModuleAnalysisManager &AM) {
+
+  // Le PreservedAnalyses restituite da una FunctionPassManager non dicono se qualcosa è
+  // cambiato, quindi i passi vengono eseguiti uno alla volta controllando il risultato di
+  // ognuno. my-licm gira nel loop adaptor (con MemorySSA), che porta i loop in forma
+  // normale e LCSSA prima di eseguirlo e fornisce le frequenze dei blocchi usate per la
+  // hoisting speculativa.
+  FunctionAnalysisManager &FAM = AM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+  LocalOpts Local;
+  auto LICM = createFunctionToLoopPassAdaptor(LoopInvariantCodeMotion(), /*UseMemorySSA=*/true,
+                                              /*UseBlockFrequencyInfo=*/true);
+  LoopFusion Fusion;
+
+  bool Changed = false;
+  for (unsigned Iteration = 0;; Iteration++) {
+    if (Iteration == MaxIterations) {
+      NumIterationLimit++;
+      LLVM_DEBUG(dbgs() << "Raggiunto il limite di " << MaxIterations << " iterazioni.\n");
+      break;
+    }
+
+    bool IterationChanged = runAndInvalidate(Local, M, AM);
+
+    // La fusione unisce i body dei loop: la seconda esecuzione di my-licm sposta fuori
+    // dal loop fuso il codice che ora può essere condiviso (es. load dello stesso
+    // indirizzo) e promuove le locazioni accedute da entrambi i body.
+    for (Function &F : M) {
+      if (F.isDeclaration())
+        continue;
+      IterationChanged |= runAndInvalidate(LICM, F, FAM);
+      IterationChanged |= runAndInvalidate(Fusion, F, FAM);
+      IterationChanged |= runAndInvalidate(LICM, F, FAM);
+    }
+
+    LLVM_DEBUG(dbgs() << "Iterazione " << Iteration << ": "
+                      << (IterationChanged ? "modificato" : "nessuna modifica") << "\n");
+    if (!IterationChanged)
+      break;
+
+    NumIterations++;
+    Changed = true;
+  }
+
+  // Le analisi sono già state invalidate dopo ogni passo.
+  return Changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
+
+void registerLoopOptCallbacks(PassBuilder &PB) {
+
+  // -passes=my-loop-opt
+  PB.registerPipelineParsingCallback([](StringRef Name, ModulePassManager &MPM,
+                                        ArrayRef<PassBuilder::PipelineElement>) {
+    if (Name != "my-loop-opt")
+      return false;
+    MPM.addPass(LoopOptPipeline());
+    return true;
+  });
+
+  // my-licm e la fusione vengono eseguiti alla fine delle ottimizzazioni scalari, dopo le
+  // loop pass, nello stesso ordine di my-loop-opt. Le loop pipeline standard non calcolano
+  // sempre le frequenze dei blocchi, quindi my-licm ha un proprio loop adaptor.
+  PB.registerScalarOptimizerLateEPCallback([](FunctionPassManager &FPM, OptimizationLevel Level) {
+    if (!EnableLoopOpt)
+      return;
+    FPM.addPass(createFunctionToLoopPassAdaptor(LoopInvariantCodeMotion(), /*UseMemorySSA=*/true,
+                                                /*UseBlockFrequencyInfo=*/true));
+    FPM.addPass(LoopFusion());
+    FPM.addPass(createFunctionToLoopPassAdaptor(LoopInvariantCodeMotion(), /*UseMemorySSA=*/true,
+                                                /*UseBlockFrequencyInfo=*/true));
+  });
+
+  // Le ottimizzazioni locali vengono eseguite alla fine della pipeline: nell'extension
+  // point peephole instcombine verrebbe eseguito dopo e riporterebbe le shl, add e sub
+  // prodotte da localopts alla forma canonica (mul, udiv). L'adaptor esegue la versione a
+  // livello di function, così le function optnone vengono saltate.
+  PB.registerOptimizerLastEPCallback([](ModulePassManager &MPM, OptimizationLevel Level) {
+    if (EnableLoopOpt)
+      MPM.addPass(createModuleToFunctionPassAdaptor(LocalOpts()));
+  });
+}
+
+// La pipeline è un pass plugin: dipende dal PassBuilder, che le librerie delle
+// trasformazioni non possono usare. Caricandolo con -load-pass-plugin (oppure
+// collegandolo staticamente a opt) i callback vengono registrati in ogni PassBuilder.
+PassPluginLibraryInfo getLoopOptPipelinePluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "LoopOptPipeline", LLVM_VERSION_STRING,
+          registerLoopOptCallbacks};
+}
+
+#ifndef LLVM_LOOPOPTPIPELINE_LINK_INTO_TOOLS
+extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo() {
+  return getLoopOptPipelinePluginInfo();
+}
+#endif
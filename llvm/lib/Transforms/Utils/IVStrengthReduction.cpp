@@ -0,0 +1,228 @@
+#include "llvm/Transforms/Utils/IVStrengthReduction.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/MemorySSA.h"
+#include "llvm/Analysis/MemorySSAUpdater.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "my-iv-sr"
+
+STATISTIC(NumIVsCreated, "Number of derived induction variables created");
+STATISTIC(NumReplaced, "Number of instructions replaced by a derived induction variable");
+STATISTIC(NumMulsRemoved, "Number of multiplies and shifts removed from loops");
+
+// Istruzioni del loop che calcolano un'espressione affine dell'induction variable.
+using ReducibleSet = SmallPtrSet<Instruction *, 16>;
+
+const SCEVAddRecExpr *getReducibleAddRec(Instruction &Inst, Loop &L, ScalarEvolution &SE) {
+  /*
+  Funzione che restituisce l'espressione {Start,+,Step}<L> calcolata dall'istruzione,
+  se è affine rispetto al loop con Start e Step loop invariant, altrimenti nullptr.
+  */
+  if (!Inst.getType()->isIntegerTy() or !SE.isSCEVable(Inst.getType()))
+    return nullptr;
+
+  const SCEVAddRecExpr *AddRec = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(&Inst));
+  if (!AddRec or AddRec->getLoop() != &L or !AddRec->isAffine())
+    return nullptr;
+
+  const SCEV *Start = AddRec->getStart();
+  const SCEV *Step = AddRec->getStepRecurrence(SE);
+  if (!SE.isLoopInvariant(Start, &L) or !SE.isLoopInvariant(Step, &L))
+    return nullptr;
+
+  // Le divisioni sono troppo costose da ricalcolare nel preheader.
+  auto IsUDiv = [](const SCEV *S) { return isa<SCEVUDivExpr>(S); };
+  if (SCEVExprContains(Start, IsUDiv) or SCEVExprContains(Step, IsUDiv))
+    return nullptr;
+
+  return AddRec;
+}
+
+bool isMultiply(Instruction &Inst) {
+  return Inst.getOpcode() == Instruction::Mul or Inst.getOpcode() == Instruction::Shl;
+}
+
+void collectReducible(Loop &L, LoopStandardAnalysisResults &LAR,
+                      SmallVectorImpl<Instruction *> &Order, ReducibleSet &Reducible) {
+  /*
+  Funzione che trova le istruzioni che possono essere sostituite da una nuova
+  induction variable eliminando almeno una moltiplicazione:
+  - mul/shl affini rispetto al loop (es. i * stride);
+  - add/sub/or affini che usano un'istruzione già riducibile (es. a*i + b).
+  Le istruzioni vengono visitate nell'ordine dei blocchi del loop (la definizione
+  precede gli usi tranne che per i phi, che non vengono mai sostituiti).
+  */
+  for (BasicBlock *BB : L.blocks()) {
+    // Le istruzioni dei subloop verranno gestite quando il passo visita quei loop.
+    if (LAR.LI.getLoopFor(BB) != &L)
+      continue;
+
+    for (Instruction &Inst : *BB) {
+      bool Candidate = isMultiply(Inst);
+      if (!Candidate and (Inst.getOpcode() == Instruction::Add or
+                          Inst.getOpcode() == Instruction::Sub or
+                          Inst.getOpcode() == Instruction::Or))
+        Candidate = any_of(Inst.operands(), [&](Value *Op) {
+          Instruction *OpInst = dyn_cast<Instruction>(Op);
+          return OpInst and Reducible.count(OpInst);
+        });
+
+      if (Candidate and getReducibleAddRec(Inst, L, LAR.SE)) {
+        Reducible.insert(&Inst);
+        Order.push_back(&Inst);
+      }
+    }
+  }
+}
+
+PHINode *createDerivedIV(const SCEVAddRecExpr *AddRec, Loop &L, SCEVExpander &Expander,
+                         ScalarEvolution &SE, StringRef Name) {
+  /*
+  Funzione che crea una nuova induction variable che vale Start + k*Step alla
+  k-esima iterazione:
+    preheader:  %start = ..., %step = ...
+    header:     %iv = phi [%start, %preheader], [%iv.next, %latch]
+    latch:      %iv.next = add %iv, %step
+  Start e Step vengono calcolati nel preheader con SCEVExpander.
+  */
+  BasicBlock *PreHeader = L.getLoopPreheader();
+  BasicBlock *Latch = L.getLoopLatch();
+  Type *Ty = AddRec->getType();
+
+  Value *Start = Expander.expandCodeFor(AddRec->getStart(), Ty, PreHeader->getTerminator());
+  Value *Step = Expander.expandCodeFor(AddRec->getStepRecurrence(SE), Ty,
+                                       PreHeader->getTerminator());
+
+  PHINode *IV = PHINode::Create(Ty, 2, Name + ".iv", &L.getHeader()->front());
+  IRBuilder<> Builder(Latch->getTerminator());
+  Value *Next = Builder.CreateAdd(IV, Step, Name + ".iv.next");
+
+  IV->addIncoming(Start, PreHeader);
+  IV->addIncoming(Next, Latch);
+  return IV;
+}
+
+void deleteDeadInstructions(ArrayRef<WeakTrackingVH> DeadRoots, Loop &L,
+                            ScalarEvolution &SE, MemorySSAUpdater *MSSAU) {
+  /*
+  Funzione che elimina le radici sostituite e, ricorsivamente, gli operandi rimasti
+  senza usi (le moltiplicazioni che calcolavano l'espressione). Vengono eliminate solo
+  istruzioni del loop: il codice fuori dal loop non appartiene a questo loop pass.
+  Le istruzioni eliminate vengono tolte anche da MemorySSA, che resta preservata.
+  */
+  auto isDeadInLoop = [&](Instruction *I) {
+    return L.contains(I) and isInstructionTriviallyDead(I);
+  };
+
+  SmallVector<Instruction *, 16> Worklist;
+  for (const WeakTrackingVH &V : DeadRoots)
+    if (Instruction *I = dyn_cast_or_null<Instruction>(V))
+      if (isDeadInLoop(I))
+        Worklist.push_back(I);
+
+  while (!Worklist.empty()) {
+    Instruction *I = Worklist.pop_back_val();
+    if (isMultiply(*I))
+      NumMulsRemoved++;
+    SE.forgetValue(I);
+    if (MSSAU)
+      MSSAU->removeMemoryAccess(I);
+
+    // Un operando entra nella worklist una volta sola, quando perde il suo ultimo uso.
+    for (Use &Op : I->operands()) {
+      Instruction *OpInst = dyn_cast<Instruction>(Op.get());
+      Op.set(nullptr);
+      if (OpInst and OpInst->use_empty() and isDeadInLoop(OpInst))
+        Worklist.push_back(OpInst);
+    }
+    I->eraseFromParent();
+  }
+}
+
+PreservedAnalyses IVStrengthReduction::run(Loop &L, LoopAnalysisManager &LAM,
+                                           LoopStandardAnalysisResults &LAR,
+                                           LPMUpdater &LU) {
+  /*
+  Strength reduction delle induction variable: un'espressione affine dell'IV del
+  loop (es. i * stride, a*i + b) viene sostituita da una nuova induction variable
+  incrementata di Step ad ogni iterazione, così la moltiplicazione scompare dal
+  loop invece di essere trasformata in shift e add che vengono comunque eseguiti
+  ad ogni iterazione.
+  Istruzioni che calcolano la stessa espressione (SCEV) condividono la stessa IV.
+  */
+  OptimizationRemarkEmitter ORE(L.getHeader()->getParent());
+
+  if (!L.isLoopSimplifyForm())
+    return PreservedAnalyses::all();
+
+  SmallVector<Instruction *, 16> Order;
+  ReducibleSet Reducible;
+  collectReducible(L, LAR, Order, Reducible);
+
+  // Sostituisco solo le "radici": le istruzioni riducibili usate da almeno
+  // un'istruzione non riducibile. Le altre moriranno insieme alle radici.
+  SmallVector<Instruction *, 8> Roots;
+  for (Instruction *Inst : Order)
+    if (any_of(Inst->users(), [&](User *U) {
+          return !Reducible.count(cast<Instruction>(U));
+        }))
+      Roots.push_back(Inst);
+
+  const DataLayout &DL = L.getHeader()->getModule()->getDataLayout();
+  SCEVExpander Expander(LAR.SE, DL, "my-iv-sr");
+  Instruction *InsertPt = L.getLoopPreheader()->getTerminator();
+
+  // Una sola induction variable per ogni espressione (in ordine deterministico).
+  MapVector<const SCEV *, PHINode *> DerivedIVs;
+  SmallVector<WeakTrackingVH, 8> DeadRoots;
+
+  for (Instruction *Root : Roots) {
+    const SCEVAddRecExpr *AddRec = getReducibleAddRec(*Root, L, LAR.SE);
+    if (!AddRec or !Expander.isSafeToExpandAt(AddRec->getStart(), InsertPt) or
+        !Expander.isSafeToExpandAt(AddRec->getStepRecurrence(LAR.SE), InsertPt))
+      continue;
+
+    PHINode *&IV = DerivedIVs[AddRec];
+    if (!IV) {
+      IV = createDerivedIV(AddRec, L, Expander, LAR.SE, Root->getName());
+      NumIVsCreated++;
+    }
+
+    ORE.emit([&]() {
+      return OptimizationRemark(DEBUG_TYPE, "StrengthReduced", Root)
+             << "replaced " << ore::NV("Inst", Root)
+             << " with an induction variable";
+    });
+
+    LAR.SE.forgetValue(Root);
+    Root->replaceAllUsesWith(IV);
+    DeadRoots.push_back(Root);
+    NumReplaced++;
+  }
+
+  if (DerivedIVs.empty())
+    return PreservedAnalyses::all();
+
+  // MemorySSA è disponibile solo se il passo gira in loop-mssa(...): in quel
+  // caso va mantenuta aggiornata quando le istruzioni vengono eliminate.
+  std::unique_ptr<MemorySSAUpdater> MSSAU;
+  if (LAR.MSSA)
+    MSSAU = std::make_unique<MemorySSAUpdater>(LAR.MSSA);
+  deleteDeadInstructions(DeadRoots, L, LAR.SE, MSSAU.get());
+
+  if (LAR.MSSA and VerifyMemorySSA)
+    LAR.MSSA->verifyMemorySSA();
+
+  auto PA = getLoopPassPreservedAnalyses();
+  if (LAR.MSSA)
+    PA.preserve<MemorySSAAnalysis>();
+  return PA;
+}
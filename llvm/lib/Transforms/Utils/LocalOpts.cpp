@@ -7,114 +7,572 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm/Transforms/Utils/LocalOpts.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
 #include "llvm/IR/InstrTypes.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/PatternMatch.h"
+#include "llvm/IR/ValueMap.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/CommandLine.h"
 
 using namespace llvm;
+using namespace llvm::PatternMatch;
 
+#define DEBUG_TYPE "localopts"
 
-enum opType { MUL, ADD, DIV, SUB };
+STATISTIC(NumAlgebraicIdentity, "Number of algebraic identities removed");
+STATISTIC(NumMulReduced, "Number of multiplies by constant strength-reduced");
+STATISTIC(NumMulNotProfitable, "Number of multiplies by constant kept by the cost model");
+STATISTIC(NumDivByConstant, "Number of divisions/remainders by constant lowered");
+STATISTIC(NumMultiInstOpt, "Number of add/sub chains collapsed");
+STATISTIC(NumDeadInstErased, "Number of dead instructions erased");
 
-bool strenghtReduction(Instruction &inst, opType opT) {
+static cl::opt<unsigned> MulLatencyOverride(
+    "localopts-mul-latency", cl::init(0), cl::Hidden,
+    cl::desc("Latency of the native multiply used by the multiply cost model "
+             "instead of the target one (0: ask the target)"));
+
+
+enum opType { MUL, ADD };
+
+// Worklist delle istruzioni ancora da visitare nel blocco corrente.
+using Worklist = SmallSetVector<Instruction *, 16>;
+
+// Le chiavi della tabella non devono seguire il RAUW: un valore rimpiazzato
+// mantiene la propria (base, offset), mentre quelli cancellati vengono rimossi.
+struct OffsetMapConfig : ValueMapConfig<Value *> {
+  enum { FollowRAUW = false };
+};
+
+// Tabella (per funzione) che associa a ogni valore la coppia (base, offset
+// costante accumulato) tale che valore = base + offset. Per i vettori l'offset
+// ha un valore per ogni lane.
+using OffsetTable =
+    ValueMap<Value *, std::pair<Value *, Constant *>, OffsetMapConfig>;
+
+// Numero massimo di visite per istruzione: garantisce che il punto fisso
+// venga raggiunto in tempo lineare rispetto alla dimensione del blocco.
+static const unsigned MaxVisitsPerInst = 8;
+
+void replaceAndRequeue(Instruction &inst, Value *newVal, Worklist &WL) {
   /*
-  Funzione che applica strenght reduction a mul e div
-  x * 16 = x << 4
-  y / 8 = x >> 3
+  Rimpiazza tutti gli usi di inst con newVal e rimette in coda gli user
+  (che ora usano newVal) e newVal stesso se è un'istruzione appena creata,
+  in modo tale che eventuali ottimizzazioni "a cascata" vengano applicate.
   */
+  BasicBlock *BB = inst.getParent();
 
-  int pos = 0;
-  
-  for (auto operand = inst.op_begin(); operand != inst.op_end();
-       operand++, pos++) {
-    ConstantInt *C = dyn_cast<ConstantInt>(operand);
-    if (C) {
-      // Scorrendo gli operandi, se incontro una costante che
-      // è un multiplo di 2 allora potrò applicare la strenght reduction.
-      APInt value = C->getValue();
-      if (value.isPowerOf2()) {
-        // Il tot di shift corrisponderà al Log2 
-        int shift_count = C->getValue().exactLogBase2();
-
-        Instruction::BinaryOps shiftT;
-
-        // Definisco il tipo di operando che andrò a creare in base all'istruzione. 
-        if (opT == MUL)
-          shiftT = Instruction::Shl;
-        else if (opT == DIV)
-          shiftT = Instruction::LShr; 
-        else 
-          return false;
-
-        // Creo l'istruzione di shift con l'operando opposto. 
-        Instruction *shiftInst =
-            BinaryOperator::Create(shiftT, inst.getOperand(!pos),
-                                   ConstantInt::get(C->getType(), shift_count));
-
-        shiftInst->insertAfter(&inst);
-        inst.replaceAllUsesWith(shiftInst);
-        outs() << "Strength Reduction\n\tInstruction:\n\t\t" << inst
-               << "\n\tReplaced with:\n\t\t" << *shiftInst << "\n\n";
-        return true;
+  for (User *U : inst.users()) {
+    Instruction *UserInst = dyn_cast<Instruction>(U);
+    // Le ottimizzazioni sono locali: rimetto in coda solo gli user del blocco.
+    if (UserInst && UserInst->getParent() == BB)
+      WL.insert(UserInst);
+  }
+
+  Instruction *NewInst = dyn_cast<Instruction>(newVal);
+  if (NewInst && NewInst->getParent() == BB)
+    WL.insert(NewInst);
+
+  inst.replaceAllUsesWith(newVal);
+}
+
+// Un termine della decomposizione di una costante: +-(x << Shift).
+struct MulTerm {
+  unsigned Shift;
+  bool Neg;
+};
+
+// Sequenza di termini la cui somma equivale alla moltiplicazione per un fattore.
+using MulTerms = SmallVector<MulTerm, 8>;
+
+// Sequenza di fattori applicati uno dopo l'altro: x * C = ((x * f1) * f2) ...
+using MulPlan = SmallVector<MulTerms, 2>;
+
+// Numero massimo di istruzioni con cui è possibile sostituire una mul.
+static const unsigned MaxMulDecompositionOps = 6;
+
+// Profondità massima della ricerca dei fattori del tipo 2^k +- 1.
+static const unsigned MaxMulFactorDepth = 2;
+
+MulTerms getCanonicalSignedDigits(const APInt &C) {
+  /*
+  Funzione che calcola la rappresentazione CSD (canonical signed digit) della costante:
+  la scrittura in cifre {-1, 0, 1} con il minor numero di cifre non nulle.
+    15 = 10000 - 00001  ->  (x << 4) - x
+    10 = 01000 + 00010  ->  (x << 3) + (x << 1)
+  */
+  unsigned N = C.getBitWidth();
+  APInt V = C.zext(N + 1);
+  MulTerms Terms;
+
+  for (unsigned i = 0; !V.isZero(); i++, V.lshrInPlace(1)) {
+    if (!V[0])
+      continue;
+
+    // Se i due bit meno significativi sono 11 conviene sottrarre (cifra -1)
+    // e propagare il riporto, altrimenti si somma (cifra +1).
+    bool Neg = V[1];
+    if (Neg)
+      V += 1;
+    else
+      V -= 1;
+
+    // I termini con shift >= N valgono 0 in aritmetica modulo 2^N.
+    if (i < N)
+      Terms.push_back({i, Neg});
+  }
+
+  // Metto in testa un termine positivo, se esiste, per evitare la negazione iniziale.
+  std::stable_partition(Terms.begin(), Terms.end(),
+                        [](const MulTerm &T) { return !T.Neg; });
+  return Terms;
+}
+
+MulTerms getBinaryDigits(const APInt &C) {
+  /*
+  Funzione che restituisce la rappresentazione binaria della costante come termini
+  tutti positivi (es. 3 = 2 + 1), utile quando le lane di un vettore hanno CSD
+  di forma diversa.
+  */
+  MulTerms Terms;
+  for (unsigned i = 0; i < C.getBitWidth(); i++)
+    if (C[i])
+      Terms.push_back({i, false});
+  return Terms;
+}
+
+bool getLaneMulTerms(Constant *C, FixedVectorType *VecTy, bool UseCSD,
+                     SmallVectorImpl<MulTerms> &Lanes) {
+  /*
+  Funzione che decompone ogni lane della costante e controlla che tutte abbiano
+  la stessa forma: stesso numero di termini e stessi segni.
+  */
+  Lanes.clear();
+  for (unsigned i = 0; i < VecTy->getNumElements(); i++) {
+    ConstantInt *Lane = dyn_cast_or_null<ConstantInt>(C->getAggregateElement(i));
+    if (!Lane || Lane->isZero())
+      return false;
+
+    Lanes.push_back(UseCSD ? getCanonicalSignedDigits(Lane->getValue())
+                           : getBinaryDigits(Lane->getValue()));
+
+    const MulTerms &First = Lanes.front(), &Last = Lanes.back();
+    if (Last.size() != First.size())
+      return false;
+    for (unsigned j = 0; j < First.size(); j++)
+      if (Last[j].Neg != First[j].Neg)
+        return false;
+  }
+  return true;
+}
+
+unsigned getMulTermsOps(const MulTerms &Terms) {
+  /*
+  Funzione che conta le istruzioni necessarie per emettere i termini:
+  uno shift per ogni termine traslato, una add/sub per ogni termine successivo
+  al primo e una negazione se tutti i termini sono negativi.
+  */
+  unsigned Ops = Terms.size() - 1;
+  for (const MulTerm &T : Terms)
+    if (T.Shift)
+      Ops++;
+  if (Terms.front().Neg)
+    Ops++;
+  return Ops;
+}
+
+InstructionCost getMulTermsLatency(const MulTerms &Terms, Type *Ty,
+                                   const TargetTransformInfo &TTI) {
+  /*
+  Funzione che stima il cammino critico dei termini: gli shift sono indipendenti
+  tra loro, mentre le add/sub formano una catena.
+  */
+  const auto CostKind = TargetTransformInfo::TCK_Latency;
+  InstructionCost Latency = 0;
+
+  if (any_of(Terms, [](const MulTerm &T) { return T.Shift != 0; }))
+    Latency += TTI.getArithmeticInstrCost(Instruction::Shl, Ty, CostKind);
+
+  unsigned Chain = Terms.size() - 1 + (Terms.front().Neg ? 1 : 0);
+  Latency += TTI.getArithmeticInstrCost(Instruction::Add, Ty, CostKind) * Chain;
+  return Latency;
+}
+
+void findMulPlan(const APInt &C, Type *Ty, const TargetTransformInfo &TTI,
+                 unsigned Depth, MulPlan &Best, InstructionCost &BestLatency,
+                 unsigned &BestOps) {
+  /*
+  Funzione che cerca la sequenza di shift/add/sub più economica per x * C:
+  - la decomposizione CSD diretta della costante;
+  - oppure C = f * (C / f) con f = 2^k +- 1, decomponendo ricorsivamente C / f.
+    45 = 5 * 9  ->  t = (x << 2) + x, (t << 3) + t
+  */
+  MulTerms Terms = getCanonicalSignedDigits(C);
+  Best = {Terms};
+  BestLatency = getMulTermsLatency(Terms, Ty, TTI);
+  BestOps = getMulTermsOps(Terms);
+
+  if (Depth == MaxMulFactorDepth)
+    return;
+
+  unsigned N = C.getBitWidth();
+  for (unsigned k = 1; k < N; k++) {
+    for (bool Plus : {false, true}) {
+      APInt F = APInt::getOneBitSet(N, k);
+      F = Plus ? F + 1 : F - 1;
+
+      if (F.ule(1) || F.uge(C) || !C.urem(F).isZero())
+        continue;
+
+      MulPlan Rest;
+      InstructionCost RestLatency;
+      unsigned RestOps;
+      findMulPlan(C.udiv(F), Ty, TTI, Depth + 1, Rest, RestLatency, RestOps);
+
+      MulTerms FTerms = getCanonicalSignedDigits(F);
+      InstructionCost Latency = getMulTermsLatency(FTerms, Ty, TTI) + RestLatency;
+      unsigned Ops = getMulTermsOps(FTerms) + RestOps;
+
+      if (Latency < BestLatency || (Latency == BestLatency && Ops < BestOps)) {
+        Best = {FTerms};
+        Best.append(Rest.begin(), Rest.end());
+        BestLatency = Latency;
+        BestOps = Ops;
       }
     }
   }
-  return false;
 }
 
-bool advStrenghtReduction(Instruction &inst) {
+Value *emitMulTerms(IRBuilder<> &Builder, Value *X, const MulTerms &Terms) {
   /*
-    Advanced Strenght Reduction:
-      x * 15 = 15 * x = (x << 4) - x
-      or
-      x * 17 = 17 * x = (x << 4) + x
+  Funzione che emette la somma dei termini +-(x << Shift).
   */
-  int pos = 0;
+  Value *Acc = nullptr;
+
+  for (const MulTerm &T : Terms) {
+    Value *Term = T.Shift ? Builder.CreateShl(X, T.Shift) : X;
+
+    if (!Acc)
+      Acc = T.Neg ? Builder.CreateNeg(Term) : Term;
+    else
+      Acc = T.Neg ? Builder.CreateSub(Acc, Term) : Builder.CreateAdd(Acc, Term);
+  }
+  return Acc;
+}
+
+bool isMulPlanProfitable(InstructionCost Latency, unsigned Ops, Type *Ty,
+                         const TargetTransformInfo &TTI) {
   /*
-    Funzione che applica advanced strenght reduction a mul
-      x * 15 = 15 * x = (x << 4) - x
-      x * 17 = 17 * x = (x << 4) + x
+  Funzione che confronta la sequenza con la mul nativa secondo il cost model del
+  target (a parità di costo conviene solo se è un'unica istruzione).
   */
+  // -localopts-mul-latency rende le decisioni indipendenti dal target (es. nei test).
+  InstructionCost MulLatency =
+      MulLatencyOverride ? InstructionCost(MulLatencyOverride)
+                         : TTI.getArithmeticInstrCost(Instruction::Mul, Ty,
+                                                      TargetTransformInfo::TCK_Latency);
+
+  return Ops <= MaxMulDecompositionOps && Latency.isValid() &&
+         (Latency < MulLatency || (Latency == MulLatency && Ops == 1));
+}
+
+Value *emitMulByLaneConstants(IRBuilder<> &Builder, Value *X, Constant *C,
+                              const TargetTransformInfo &TTI) {
+  /*
+  Funzione che gestisce le mul per un vettore di costanti non uniforme: se la CSD
+  di ogni lane ha la stessa forma (stesso numero di termini, stessi segni) basta
+  usare shift vettoriali con un valore diverso per ogni lane.
+    x * <2, 4, 8, 16> = x << <1, 2, 3, 4>
+    x * <3, 5, 9, 17> = (x << <1, 2, 3, 4>) + x
+  */
+  auto *VecTy = dyn_cast<FixedVectorType>(C->getType());
+  if (!VecTy)
+    return nullptr;
+
+  // Provo prima la CSD e, se le lane hanno forme diverse, la forma binaria.
+  SmallVector<MulTerms, 8> Lanes;
+  if (!getLaneMulTerms(C, VecTy, true, Lanes) &&
+      !getLaneMulTerms(C, VecTy, false, Lanes))
+    return nullptr;
+
+  // Il costo si stima sulla forma comune: uno shift è necessario se almeno una
+  // lane ha uno shift diverso da 0 per quel termine.
+  MulTerms Shape = Lanes.front();
+  for (unsigned j = 0; j < Shape.size(); j++)
+    Shape[j].Shift = any_of(Lanes, [&](const MulTerms &L) { return L[j].Shift; });
+
+  if (!isMulPlanProfitable(getMulTermsLatency(Shape, VecTy, TTI),
+                           getMulTermsOps(Shape), VecTy, TTI))
+    return nullptr;
+
+  Type *EltTy = VecTy->getElementType();
+  Value *Acc = nullptr;
+
+  for (unsigned j = 0; j < Shape.size(); j++) {
+    SmallVector<Constant *, 8> Shifts;
+    for (const MulTerms &L : Lanes)
+      Shifts.push_back(ConstantInt::get(EltTy, L[j].Shift));
+
+    Value *Term = Shape[j].Shift ? Builder.CreateShl(X, ConstantVector::get(Shifts)) : X;
+
+    if (!Acc)
+      Acc = Shape[j].Neg ? Builder.CreateNeg(Term) : Term;
+    else
+      Acc = Shape[j].Neg ? Builder.CreateSub(Acc, Term) : Builder.CreateAdd(Acc, Term);
+  }
+  return Acc;
+}
+
+bool mulByConstant(Instruction &inst, const TargetTransformInfo &TTI,
+                   OptimizationRemarkEmitter &ORE, Worklist &WL) {
+  /*
+  Funzione che applica la strength reduction a mul per una costante qualsiasi
+  (anche vettoriale, splat o con valori diversi per ogni lane):
+    x * 16 = x << 4
+    x * 15 = (x << 4) - x
+    x * 10 = (x << 3) + (x << 1)
+  La sequenza viene emessa solo se, secondo il cost model del target, è più
+  veloce della moltiplicazione nativa (a parità di costo solo se è un unico shift).
+  */
+  int pos = 0;
 
   for (auto operand = inst.op_begin(); operand != inst.op_end();
        operand++, pos++) {
-    ConstantInt *C = dyn_cast<ConstantInt>(operand);
-    if (C) {
-      APInt value = C->getValue();
-
-      Instruction::BinaryOps sumType;
-      int shift_count = 0;
-      // Uguale alla strenght reductions solo che controllo che la costante sia un potenza di 2 +- 1
-
-      if ((value + 1).isPowerOf2()) {
-        shift_count = (value + 1).exactLogBase2();
-        sumType = Instruction::Sub;
-      } else if ((value - 1).isPowerOf2()) {
-        shift_count = (value - 1).exactLogBase2();
-        sumType = Instruction::Add;
-      } else
+    Type *Ty = inst.getType();
+    IRBuilder<> Builder(&inst);
+    Value *Result = nullptr;
+    const APInt *C;
+
+    if (match(operand->get(), m_APInt(C))) {
+      if (C->isZero())
         continue;
 
-      Instruction *shiftInst =
-          BinaryOperator::Create(BinaryOperator::Shl, inst.getOperand(!pos),
-                                 ConstantInt::get(C->getType(), shift_count));
+      MulPlan Plan;
+      InstructionCost Latency;
+      unsigned Ops;
+      findMulPlan(*C, Ty, TTI, 0, Plan, Latency, Ops);
+
+      if (!isMulPlanProfitable(Latency, Ops, Ty, TTI)) {
+        NumMulNotProfitable++;
+        ORE.emit([&]() {
+          return OptimizationRemarkMissed(DEBUG_TYPE, "MulNotProfitable", &inst)
+                 << "multiply by " << ore::NV("Constant", toString(*C, 10, true))
+                 << " kept: shift/add sequence of " << ore::NV("Ops", Ops)
+                 << " instructions is not cheaper than the native multiply";
+        });
+        return false;
+      }
 
-      Instruction *sumInst =
-          BinaryOperator::Create(sumType, inst.getOperand(!pos), shiftInst);
+      Result = inst.getOperand(!pos);
+      for (const MulTerms &Terms : Plan)
+        Result = emitMulTerms(Builder, Result, Terms);
+    } else if (Constant *CV = dyn_cast<Constant>(operand)) {
+      Result = emitMulByLaneConstants(Builder, inst.getOperand(!pos), CV, TTI);
+    }
 
-      shiftInst->insertAfter(&inst);
-      sumInst->insertAfter(shiftInst);
-      inst.replaceAllUsesWith(sumInst);
+    if (!Result)
+      continue;
 
-      outs() << "Advanced Strength Reduction\n\tInstruction:\n\t\t" << inst
-             << "\n\tReplaced with:\n\t\t" << *shiftInst << " and " << *sumInst
-             << "\n\n";
-      return true;
-    }
+    NumMulReduced++;
+    ORE.emit([&]() {
+      return OptimizationRemark(DEBUG_TYPE, "StrengthReduction", &inst)
+             << "multiply by constant replaced with shifts and adds";
+    });
+    replaceAndRequeue(inst, Result, WL);
+    return true;
   }
   return false;
 }
 
-bool algebraicIdentity(Instruction &inst, opType opT) {
+Value *createMulHigh(IRBuilder<> &Builder, Value *X, const APInt &Magic,
+                     bool isSigned) {
+  /*
+  Funzione che genera la parte alta (N bit) del prodotto a 2N bit tra X e Magic:
+  estendo entrambi gli operandi, moltiplico e tengo i bit più significativi.
+  */
+  Type *Ty = X->getType();
+  unsigned N = Ty->getScalarSizeInBits();
+  Type *WideTy = Ty->getWithNewBitWidth(2 * N);
+
+  Value *WideX = isSigned ? Builder.CreateSExt(X, WideTy)
+                          : Builder.CreateZExt(X, WideTy);
+  APInt WideMagic = isSigned ? Magic.sext(2 * N) : Magic.zext(2 * N);
+
+  Value *Prod = Builder.CreateMul(WideX, ConstantInt::get(WideTy, WideMagic));
+  return Builder.CreateTrunc(Builder.CreateLShr(Prod, N), Ty);
+}
+
+Value *createUDiv(IRBuilder<> &Builder, Value *X, const APInt &D) {
+  /*
+  Divisione unsigned per una costante D (non potenza di 2):
+    q = mulhu(x, m) >> s
+  con m = ceil(2^p / D) per il più piccolo p che rende l'errore trascurabile.
+  Se m non sta in N bit si usa la variante "add" con m' = m - 2^N:
+    t = mulhu(x, m'), q = (((x - t) >> 1) + t) >> (L - 1)
+  */
+  unsigned N = D.getBitWidth();
+  unsigned L = D.ceilLogBase2();
+  unsigned W = 2 * N + 1;
+
+  APInt WideD = D.zext(W);
+  APInt Limit = APInt::getOneBitSet(W, N);
+  APInt Magic;
+
+  for (unsigned P = N; P <= N + L; P++) {
+    APInt Pow = APInt::getOneBitSet(W, P);
+    Magic = (Pow + WideD - 1).udiv(WideD);
+    APInt Err = Magic * WideD - Pow;
+
+    // Se m * D supera 2^p di al più 2^(p-N) allora floor(x * m / 2^p) = floor(x / D)
+    // per ogni x a N bit.
+    if (Magic.ult(Limit) && Err.ule(APInt::getOneBitSet(W, P - N))) {
+      Value *Q = createMulHigh(Builder, X, Magic.trunc(N), false);
+      return P == N ? Q : Builder.CreateLShr(Q, P - N);
+    }
+  }
+
+  // Nessun m a N bit: con p = N + L il magic number è compreso tra 2^N e 2^(N+1).
+  Value *T = createMulHigh(Builder, X, (Magic - Limit).trunc(N), false);
+  Value *Q = Builder.CreateLShr(Builder.CreateSub(X, T), 1);
+  Q = Builder.CreateAdd(Q, T);
+  return Builder.CreateLShr(Q, L - 1);
+}
+
+Value *createSDiv(IRBuilder<> &Builder, Value *X, const APInt &D) {
+  /*
+  Divisione signed per una costante D con |D| >= 2 (Hacker's Delight, 10-1):
+    q = mulhs(x, m) [+ x se D > 0 e m < 0] [- x se D < 0 e m > 0]
+    q = q >>a s
+    q = q + (q >>u (N-1))   -> arrotonda verso lo zero i quozienti negativi
+  */
+  unsigned N = D.getBitWidth();
+  APInt SignedMin = APInt::getSignedMinValue(N);
+
+  APInt AD = D.abs();
+  APInt T = SignedMin + D.lshr(N - 1);
+  APInt ANC = T - 1 - T.urem(AD);
+  unsigned P = N - 1;
+
+  APInt Q1 = SignedMin.udiv(ANC), R1 = SignedMin - Q1 * ANC;
+  APInt Q2 = SignedMin.udiv(AD), R2 = SignedMin - Q2 * AD;
+  APInt Delta;
+
+  do {
+    P++;
+    Q1 <<= 1;
+    R1 <<= 1;
+    if (R1.uge(ANC)) {
+      Q1 += 1;
+      R1 -= ANC;
+    }
+    Q2 <<= 1;
+    R2 <<= 1;
+    if (R2.uge(AD)) {
+      Q2 += 1;
+      R2 -= AD;
+    }
+    Delta = AD - R2;
+  } while (Q1.ult(Delta) || (Q1 == Delta && R1.isZero()));
+
+  APInt Magic = Q2 + 1;
+  if (D.isNegative())
+    Magic = -Magic;
+
+  Value *Q = createMulHigh(Builder, X, Magic, true);
+
+  if (D.isStrictlyPositive() && Magic.isNegative())
+    Q = Builder.CreateAdd(Q, X);
+  else if (D.isNegative() && Magic.isStrictlyPositive())
+    Q = Builder.CreateSub(Q, X);
+
+  if (P - N > 0)
+    Q = Builder.CreateAShr(Q, P - N);
+
+  return Builder.CreateAdd(Q, Builder.CreateLShr(Q, N - 1));
+}
+
+bool divisionByConstant(Instruction &inst, OptimizationRemarkEmitter &ORE,
+                        Worklist &WL) {
+  /*
+  Funzione che sostituisce udiv, sdiv, urem e srem per una costante con sequenze
+  di shift, moltiplicazioni "high" e somme, evitando la divisione hardware.
+    x / 8      = x >> 3                     (unsigned)
+    x / 8      = (x + bias) >>a 3           (signed, bias = 7 se x < 0)
+    x / 7      = mulhu(x, m) >> s           (magic number)
+    x % D      = x - (x / D) * D
+  */
+  // Per i vettori sono gestiti solo i divisori splat: con un divisore diverso per
+  // ogni lane servirebbero magic number, shift e correzioni diversi lane per lane.
+  Constant *C = dyn_cast<Constant>(inst.getOperand(1));
+  const APInt *DivC;
+  if (!C || !match(C, m_APInt(DivC)))
+    return false;
+
+  unsigned opcode = inst.getOpcode();
+  bool isSigned = opcode == Instruction::SDiv || opcode == Instruction::SRem;
+  bool isRem = opcode == Instruction::URem || opcode == Instruction::SRem;
+
+  APInt D = *DivC;
+  unsigned N = D.getBitWidth();
+
+  // Casi banali o non convenienti: divisione per 0, 1, -1 e INT_MIN.
+  if (N < 3 || D.isZero() || D.isOne() ||
+      (isSigned && (D.isAllOnes() || D.isMinSignedValue())))
+    return false;
+
+  Value *X = inst.getOperand(0);
+  IRBuilder<> Builder(&inst);
+  Value *Q = nullptr;
+  Value *Result = nullptr;
+
+  if (!isSigned && D.isPowerOf2()) {
+    unsigned K = D.exactLogBase2();
+    Result = isRem ? Builder.CreateAnd(X, ConstantInt::get(X->getType(), D - 1))
+                   : Builder.CreateLShr(X, K);
+  } else if (isSigned && D.abs().isPowerOf2()) {
+    // Lo shift aritmetico arrotonda verso -inf: aggiungo 2^K - 1 ai valori
+    // negativi per ottenere l'arrotondamento verso lo zero richiesto da sdiv.
+    unsigned K = D.abs().exactLogBase2();
+    Value *Sign = Builder.CreateAShr(X, N - 1);
+    Value *Bias = Builder.CreateLShr(Sign, N - K);
+    Value *Shifted = Builder.CreateAShr(Builder.CreateAdd(X, Bias), K);
+
+    if (isRem)
+      Result = Builder.CreateSub(X, Builder.CreateShl(Shifted, K));
+    else
+      Result = D.isNegative() ? Builder.CreateNeg(Shifted) : Shifted;
+  } else {
+    Q = isSigned ? createSDiv(Builder, X, D) : createUDiv(Builder, X, D);
+    if (isRem) {
+      // Il resto si ricava dal quoziente: la moltiplicazione per D viene
+      // rimessa in coda così da poter essere a sua volta ridotta.
+      Value *Prod = Builder.CreateMul(Q, C);
+      if (Instruction *ProdInst = dyn_cast<Instruction>(Prod))
+        WL.insert(ProdInst);
+      Result = Builder.CreateSub(X, Prod);
+    } else
+      Result = Q;
+  }
+
+  NumDivByConstant++;
+  ORE.emit([&]() {
+    return OptimizationRemark(DEBUG_TYPE, "DivisionByConstant", &inst)
+           << ore::NV("Opcode", inst.getOpcodeName()) << " by "
+           << ore::NV("Constant", toString(D, 10, isSigned))
+           << " lowered without a hardware divide";
+  });
+  replaceAndRequeue(inst, Result, WL);
+  return true;
+}
+
+bool algebraicIdentity(Instruction &inst, opType opT,
+                       OptimizationRemarkEmitter &ORE, Worklist &WL) {
   /*
   Funzione che applica l'algebraic identity sia per la mul che per la add. 
   */
@@ -122,163 +580,261 @@ bool algebraicIdentity(Instruction &inst, opType opT) {
 
   for (auto operand = inst.op_begin(); operand != inst.op_end();
        operand++, pos++) {
-    ConstantInt *C = dyn_cast<ConstantInt>(operand);
-    if (C) {
-      APInt value = C->getValue();
-
-      // Scorrendo gli operandi dell'istruzione passata come parametro, se c'è una costante allora:
-      // - se la costante è 0 E l'istruzione su cui si sta iterando è una add
-      // oppure 
-      // - se la costante è 1 E l'istruzione su cui si sta iterando è una mul
-      // Allora potrò applicare l'algebraic identity. 
-
-      if ((value.isZero() && opT == ADD) || (value.isOne() && opT == MUL)) {
-        inst.replaceAllUsesWith(inst.getOperand(!pos)); // Rimpiazzo tutti gli usi dell'istruzione con l'altro operando
-        outs() << "Algebraic Identity\n\tInstruction:\n\t" << inst
-               << "\n\thas a " << value << " in " << pos << " position."
-               << "\n\n";
-        return true;
-      }
+    // Scorrendo gli operandi dell'istruzione passata come parametro, se c'è una costante allora:
+    // - se la costante è 0 E l'istruzione su cui si sta iterando è una add
+    // oppure 
+    // - se la costante è 1 E l'istruzione su cui si sta iterando è una mul
+    // Allora potrò applicare l'algebraic identity. 
+    // Per i vettori ogni lane deve valere 0 (o 1), tranne le lane undef/poison
+    // che possono assumere quel valore.
+    bool isIdentity = opT == ADD ? match(operand->get(), m_ZeroInt())
+                                 : match(operand->get(), m_One());
+
+    if (isIdentity) {
+      NumAlgebraicIdentity++;
+      ORE.emit([&]() {
+        return OptimizationRemark(DEBUG_TYPE, "AlgebraicIdentity", &inst)
+               << ore::NV("Opcode", inst.getOpcodeName()) << " by "
+               << ore::NV("Constant", opT == ADD ? 0 : 1)
+               << " replaced with its other operand";
+      });
+      replaceAndRequeue(inst, inst.getOperand(!pos), WL); // Rimpiazzo tutti gli usi dell'istruzione con l'altro operando
+      return true;
     }
   }
   return false;
 }
 
-bool multiInstOpt(Instruction &inst, opType opT) {
+Constant *getIntegerConstant(Value *V) {
   /*
-  Funzione che applica la multi inst optimization
-  𝑎 = 𝑏 + 1, 𝑐 = 𝑎 − 1  -> 𝑎 = 𝑏 + 1, 𝑐 = 𝑏
+  Funzione che restituisce V se è una costante intera: uno scalare oppure un vettore
+  splat o con un valore diverso per ogni lane (es. <i32 1, i32 2>). Le constant
+  expression e i vettori con lane undef/poison non vengono considerati.
   */
-  int pos = 0;
-  for (auto operandUser = inst.op_begin(); operandUser != inst.op_end();
-       operandUser++, pos++) {
-    ConstantInt *CUser = dyn_cast<ConstantInt>(operandUser);
-    // Scorrendo gli operandi, se c'è una costante...
-    if (CUser) {
-      
-      //... salvo il valore che dovrò trovare tra gli usi. 
-      APInt valueToFind = CUser->getValue();
-
-      // E l'operatore che sarà l'opposto rispetto all'istruzione di partenza. 
-      Instruction::BinaryOps opToFind =
-          opT == SUB ? Instruction::Add : Instruction::Sub;
-
-      // Itero sugli usi
-      for (auto iter = inst.user_begin(); iter != inst.user_end(); ++iter) {
-        
-        User *instUser = *iter;
-        BinaryOperator *opUsee = dyn_cast<BinaryOperator>(instUser);
-        // Se trovo una binary instruction che, tra gli operandi, ha il valore salvato precedenemtne
-        // ed ha come operatore quello salvato. 
-        if (not opUsee)
-          continue;
-
-        for (auto operandUsee = instUser->op_begin();
-             operandUsee != instUser->op_end(); operandUsee++) {
-          ConstantInt *CUsee = dyn_cast<ConstantInt>(operandUsee);
-          if (CUsee && opUsee->getOpcode() == opToFind &&
-              CUsee->getValue() == valueToFind) {
-            
-            // Allora potrò procedere con l'ottimizzazione. 
-
-            outs() << "Multi-Instruction Optimization\n\t" << inst << " and "
-                   << *instUser << "\n ";
-            // Rimpiazzo tutti gli usi con l'operatore opposto. 
-            instUser->replaceAllUsesWith(inst.getOperand(!pos));
-
-            return true;
-          }
-        }
-      }
-    }
+  Constant *C = dyn_cast<Constant>(V);
+  const APInt *Splat;
+  if (!C || isa<ConstantExpr>(C))
+    return nullptr;
+  if (match(C, m_APInt(Splat)))
+    return C;
+
+  auto *VecTy = dyn_cast<FixedVectorType>(C->getType());
+  if (!VecTy)
+    return nullptr;
+  for (unsigned i = 0; i < VecTy->getNumElements(); i++)
+    if (!isa_and_nonnull<ConstantInt>(C->getAggregateElement(i)))
+      return nullptr;
+  return C;
+}
+
+bool multiInstOpt(Instruction &inst, OffsetTable &Offsets,
+                  OptimizationRemarkEmitter &ORE, Worklist &WL) {
+  /*
+  Funzione che applica la multi inst optimization sulle catene di add/sub per
+  costanti, usando la tabella (base, offset) della funzione:
+    𝑎 = 𝑏 + 1, 𝑐 = 𝑎 − 1            -> 𝑐 = 𝑏
+    𝑎 = 𝑏 + 3, 𝑐 = 5 + 𝑎, 𝑑 = 𝑐 − 8  -> 𝑑 = 𝑏
+    𝑎 = 𝑏 + 3, 𝑐 = 𝑎 + 5            -> 𝑐 = 𝑏 + 8
+  Per i vettori gli offset vengono sommati lane per lane, anche se le costanti
+  non sono splat:
+    𝑎 = 𝑏 + <1, 2>, 𝑐 = 𝑎 − <1, 2>  -> 𝑐 = 𝑏
+  */
+  bool isSub = inst.getOpcode() == Instruction::Sub;
+  Value *X = nullptr;
+  Constant *C = nullptr;
+
+  // Forme gestite: x + C, C + x, x - C (C - x non è un offset di x).
+  if ((C = getIntegerConstant(inst.getOperand(1))))
+    X = inst.getOperand(0);
+  else if (!isSub && (C = getIntegerConstant(inst.getOperand(0))))
+    X = inst.getOperand(1);
+  else
+    return false;
+
+  // Se l'operando è a sua volta nella tabella riparto dalla sua base,
+  // altrimenti l'operando stesso è la base con offset 0.
+  Value *Base = X;
+  Constant *Offset = Constant::getNullValue(inst.getType());
+  auto Entry = Offsets.find(X);
+  if (Entry != Offsets.end()) {
+    Base = Entry->second.first;
+    Offset = Entry->second.second;
   }
-  return false;
+
+  // Somme di costanti intere: il folding avviene lane per lane e non crea
+  // constant expression.
+  Offset = isSub ? ConstantExpr::getSub(Offset, C) : ConstantExpr::getAdd(Offset, C);
+  Offsets[&inst] = std::make_pair(Base, Offset);
+
+  // La catena non si accorcia: l'istruzione è già nella forma base + offset.
+  if (Base == X)
+    return false;
+
+  Value *Result = Base;
+  bool isZeroOffset = Offset->isNullValue();
+  if (!isZeroOffset) {
+    IRBuilder<> Builder(&inst);
+    Result = Builder.CreateAdd(Base, Offset);
+  }
+
+  NumMultiInstOpt++;
+  ORE.emit([&]() {
+    return OptimizationRemark(DEBUG_TYPE, "MultiInstOpt", &inst)
+           << "add/sub chain collapsed to "
+           << (isZeroOffset ? "its base value" : "a single add");
+  });
+  replaceAndRequeue(inst, Result, WL);
+  return true;
 }
 
-bool runOnBasicBlock(BasicBlock &B) {
+bool runOnInstruction(Instruction &inst, const TargetTransformInfo &TTI,
+                      OffsetTable &Offsets, OptimizationRemarkEmitter &ORE,
+                      Worklist &WL) {
   /*
     Try applying the various optimizazions (based on the type of operation) whenever a binary operator is found
   */
-  bool modified = false;
+  BinaryOperator *op = dyn_cast<BinaryOperator>(&inst);
 
-  for (auto &inst : B) {
-    BinaryOperator *op = dyn_cast<BinaryOperator>(&inst);
+  if (!op)
+    return false;
 
-    if (!op)
-      continue;
+  switch (op->getOpcode()) {
 
-    switch (op->getOpcode()) {
+  case BinaryOperator::Mul:
+    return algebraicIdentity(inst, MUL, ORE, WL) ||
+           mulByConstant(inst, TTI, ORE, WL);
 
-    case BinaryOperator::Mul:
-      if (!algebraicIdentity(inst, MUL) && !strenghtReduction(inst, MUL)) {
-        if (advStrenghtReduction(inst)) {
-          modified = true;
-        }
-      } else {
-        modified = true;
-      }
-      break;
-    
-    case BinaryOperator::Add:
-      if (!algebraicIdentity(inst, ADD)) {
-        if (multiInstOpt(inst, ADD)) {
-          modified = true;
-        }
-      } else {
-        modified = true;
-      }
-      break;
+  case BinaryOperator::Add:
+    return algebraicIdentity(inst, ADD, ORE, WL) ||
+           multiInstOpt(inst, Offsets, ORE, WL);
 
-    case BinaryOperator::Sub:
-      if (multiInstOpt(inst, SUB)) {
-        modified = true;
-      }
-      break;
+  case BinaryOperator::Sub:
+    return multiInstOpt(inst, Offsets, ORE, WL);
 
-    case (BinaryOperator::UDiv):
-    case (BinaryOperator::SDiv):
-      if (strenghtReduction(inst, DIV)) {
-        modified = true;
-      }
-      break;
+  case (BinaryOperator::UDiv):
+  case (BinaryOperator::SDiv):
+  case (BinaryOperator::URem):
+  case (BinaryOperator::SRem):
+    return divisionByConstant(inst, ORE, WL);
 
-    default:
-      break;
-    }
+  default:
+    return false;
   }
+}
+
+bool runOnBasicBlock(BasicBlock &B, const TargetTransformInfo &TTI,
+                     OffsetTable &Offsets, OptimizationRemarkEmitter &ORE) {
   /*
-    Dead Code Elimination (attempt)
+    Worklist che applica le ottimizzazioni fino al punto fisso: ogni volta che
+    un valore viene riscritto i suoi user vengono rimessi in coda, così che
+    cascate come (x * 1) + 0 vengano risolte in un'unica esecuzione del passo.
   */
-  for(auto instItr = B.begin(); instItr != B.end();){
-    BinaryOperator *op = dyn_cast<BinaryOperator>(instItr);
-    if(op and instItr->hasNUses(0))
-      instItr = instItr->eraseFromParent();
-    else
-      instItr++;
-  }
+  bool modified = false;
 
+  Worklist WL;
+  DenseMap<Instruction *, unsigned> visits;
+
+  // Inserisco le istruzioni al contrario così da estrarle nell'ordine del blocco.
+  for (auto &inst : reverse(B))
+    WL.insert(&inst);
+
+  while (!WL.empty()) {
+    Instruction *inst = WL.pop_back_val();
+
+    // Un'istruzione senza usi è già stata rimpiazzata: non serve ottimizzarla.
+    if (inst->use_empty() || ++visits[inst] > MaxVisitsPerInst)
+      continue;
+
+    if (runOnInstruction(*inst, TTI, Offsets, ORE, WL))
+      modified = true;
+  }
 
-  outs() << (modified ? "" : "No Modifies\n");
   return modified;
 }
 
-bool runOnFunction(Function &F) {
+bool eliminateDeadCode(Function &F) {
+  /*
+    Dead Code Elimination: parto da tutte le istruzioni trivially dead della
+    funzione (nessun uso e nessun side effect) e, ogni volta che ne cancello
+    una, rimetto in coda i suoi operandi che diventano a loro volta dead.
+  */
+  SmallSetVector<Instruction *, 16> DeadInsts;
+
+  for (Instruction &I : instructions(F))
+    if (isInstructionTriviallyDead(&I))
+      DeadInsts.insert(&I);
+
+  bool erased = !DeadInsts.empty();
+
+  while (!DeadInsts.empty()) {
+    Instruction *I = DeadInsts.pop_back_val();
+    salvageDebugInfo(*I);
+
+    for (Use &Op : I->operands()) {
+      Instruction *OpInst = dyn_cast<Instruction>(Op.get());
+      Op.set(nullptr);
+      if (OpInst && isInstructionTriviallyDead(OpInst))
+        DeadInsts.insert(OpInst);
+    }
+
+    I->eraseFromParent();
+    NumDeadInstErased++;
+  }
+
+  return erased;
+}
+
+bool runOnFunction(Function &F, const TargetTransformInfo &TTI,
+                   OptimizationRemarkEmitter &ORE) {
   bool Transformed = false;
+  OffsetTable Offsets;
 
   for (auto Iter = F.begin(); Iter != F.end(); ++Iter) {
-    if (runOnBasicBlock(*Iter)) {
+    if (runOnBasicBlock(*Iter, TTI, Offsets, ORE)) {
       Transformed = true;
     }
   }
 
+  // La DCE viene eseguita una sola volta, dopo aver ottimizzato tutti i blocchi.
+  if (eliminateDeadCode(F))
+    Transformed = true;
+
   return Transformed;
 }
 
 PreservedAnalyses LocalOpts::run(Module &M, ModuleAnalysisManager &AM) {
   bool Transformed = false;
 
-  for (auto Fiter = M.begin(); Fiter != M.end(); ++Fiter)
-    Transformed = Transformed | runOnFunction(*Fiter);
+  // Il cost model del target serve per decidere quando conviene ridurre una mul.
+  FunctionAnalysisManager &FAM =
+      AM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+
+  for (auto Fiter = M.begin(); Fiter != M.end(); ++Fiter) {
+    if (Fiter->isDeclaration())
+      continue;
+
+    TargetTransformInfo &TTI = FAM.getResult<TargetIRAnalysis>(*Fiter);
+    OptimizationRemarkEmitter &ORE =
+        FAM.getResult<OptimizationRemarkEmitterAnalysis>(*Fiter);
+    Transformed = Transformed | runOnFunction(*Fiter, TTI, ORE);
+  }
 
   return Transformed ? PreservedAnalyses::none() : PreservedAnalyses::all();
 }
+
+PreservedAnalyses LocalOpts::run(Function &F, FunctionAnalysisManager &AM) {
+  // Versione a livello di function, usata quando il passo viene inserito in una
+  // FunctionPassManager (es. nell'extension point optimizer last delle pipeline standard).
+  if (F.isDeclaration())
+    return PreservedAnalyses::all();
+
+  TargetTransformInfo &TTI = AM.getResult<TargetIRAnalysis>(F);
+  OptimizationRemarkEmitter &ORE = AM.getResult<OptimizationRemarkEmitterAnalysis>(F);
+  if (!runOnFunction(F, TTI, ORE))
+    return PreservedAnalyses::all();
+
+  // Le ottimizzazioni locali non modificano il control flow.
+  PreservedAnalyses PA;
+  PA.preserveSet<CFGAnalyses>();
+  return PA;
+}
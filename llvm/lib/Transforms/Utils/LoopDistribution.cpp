@@ -0,0 +1,486 @@
+#include "llvm/Transforms/Utils/LoopDistribution.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/EquivalenceClasses.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LoopIterator.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/Local.h"
+using namespace llvm;
+
+#define DEBUG_TYPE "my-loop-distribution"
+
+STATISTIC(NumDistributed, "Number of loops distributed");
+STATISTIC(NumLoopsCreated, "Number of loops created by distribution");
+
+static cl::opt<unsigned> MaxStreams(
+    "my-loop-distribution-max-streams", cl::init(4), cl::Hidden,
+    cl::desc("Maximum number of distinct arrays accessed by a loop created by "
+             "distribution before its partitions are kept apart"));
+
+// Gruppo di accessi in memoria che verranno eseguiti dallo stesso loop.
+struct Partition {
+  SmallVector<Instruction *, 8> Accesses;
+  SmallPtrSet<const SCEV *, 4> Streams;
+  bool Vectorizable = true;
+  unsigned FirstPosition = ~0U;
+
+  void merge(const Partition &Other) {
+    Accesses.append(Other.Accesses.begin(), Other.Accesses.end());
+    Streams.insert(Other.Streams.begin(), Other.Streams.end());
+    Vectorizable &= Other.Vectorizable;
+    FirstPosition = std::min(FirstPosition, Other.FirstPosition);
+  }
+};
+
+bool isDistributionCandidate(Loop *L, DominatorTree &DT) {
+  /*
+  Vengono distribuiti solo i loop più interni in forma normale, con una sola uscita e in
+  forma LCSSA: ogni copia del loop esegue lo stesso controllo e solo l'ultima fornisce i
+  valori usati dopo il loop.
+  */
+  return L->isInnermost() and L->isLoopSimplifyForm() and L->getExitingBlock() and
+         L->getExitBlock() and L->isLCSSAForm(DT);
+}
+
+bool collectAccesses(Loop *L, LoopInfo &LI, SmallVectorImpl<Instruction *> &Accesses,
+                     DenseMap<Instruction *, unsigned> &Position) {
+  /*
+  Raccoglie le load e le store del loop nell'ordine del body (reverse post order dei
+  blocchi). Restituisce false se il loop contiene altre istruzioni che accedono alla
+  memoria o hanno side effect, che non possono essere assegnate a una sola copia.
+  */
+  LoopBlocksRPO RPOT(L);
+  RPOT.perform(&LI);
+
+  unsigned Count = 0;
+  for (BasicBlock *BB : RPOT)
+    for (Instruction &I : *BB) {
+      Position[&I] = Count++;
+      if (!I.mayReadOrWriteMemory() and !I.mayHaveSideEffects())
+        continue;
+
+      LoadInst *Load = dyn_cast<LoadInst>(&I);
+      StoreInst *Store = dyn_cast<StoreInst>(&I);
+      if (!(Load and Load->isSimple()) and !(Store and Store->isSimple()))
+        return false;
+
+      Accesses.push_back(&I);
+    }
+
+  return true;
+}
+
+void collectOperandChain(Value *V, Loop *L, SmallPtrSetImpl<Instruction *> &Chain) {
+  /*
+  Raccoglie le istruzioni del loop da cui dipende il valore V, risalendo gli operandi
+  (anche attraverso i phi dell'header, cioè tra un'iterazione e la successiva).
+  */
+  SmallVector<Value *, 8> Worklist = {V};
+
+  while (!Worklist.empty()) {
+    auto *I = dyn_cast<Instruction>(Worklist.pop_back_val());
+    if (!I or !L->contains(I) or !Chain.insert(I).second)
+      continue;
+    Worklist.append(I->op_begin(), I->op_end());
+  }
+}
+
+bool dependsOnMemory(Value *V, Loop *L) {
+  /*
+  Controlla se il valore V dipende da una load del loop.
+  */
+  SmallPtrSet<Instruction *, 16> Chain;
+  collectOperandChain(V, L, Chain);
+  return any_of(Chain, [](Instruction *I) { return isa<LoadInst>(I); });
+}
+
+bool isAffineAccess(Instruction *I, Loop *L, ScalarEvolution &SE) {
+  /*
+  Un accesso può essere vettorizzato se il suo indirizzo è una ricorrenza affine del loop
+  {Base,+,Step}<L> (o è invariante).
+  */
+  const SCEV *Ptr = SE.getSCEV(getLoadStorePointerOperand(I));
+  if (SE.isLoopInvariant(Ptr, L))
+    return true;
+
+  auto *AR = dyn_cast<SCEVAddRecExpr>(Ptr);
+  return AR and AR->getLoop() == L and AR->isAffine();
+}
+
+bool usesScalarRecurrence(Instruction *I, Loop *L, ScalarEvolution &SE) {
+  /*
+  Controlla se l'accesso usa un phi dell'header che non è un'induction variable affine,
+  cioè un valore che dipende dall'iterazione precedente (es. s = s + A[i]; B[i] = s).
+  */
+  SmallPtrSet<Instruction *, 16> Chain;
+  for (Value *Op : I->operands())
+    collectOperandChain(Op, L, Chain);
+
+  return any_of(Chain, [&](Instruction *ChainI) {
+    if (!isa<PHINode>(ChainI) or ChainI->getParent() != L->getHeader())
+      return false;
+    auto *AR = SE.isSCEVable(ChainI->getType()) ? dyn_cast<SCEVAddRecExpr>(SE.getSCEV(ChainI)) : nullptr;
+    return !AR or AR->getLoop() != L or !AR->isAffine();
+  });
+}
+
+void getDependenceDirections(Instruction *Src, Instruction *Dst, DependenceInfo &DI,
+                             bool &Forward, bool &Backward, bool &Carried) {
+  /*
+  Src precede Dst nel body. La dipendenza è in avanti se Src viene eseguita prima di Dst
+  (nella stessa iterazione o in un'iterazione precedente), all'indietro se Dst in
+  un'iterazione precedente accede alla stessa locazione di Src. Le dipendenze tra
+  iterazioni diverse dei loop esterni non contano: la distribuzione cambia solo l'ordine
+  delle iterazioni di L. Carried indica una dipendenza tra iterazioni diverse di L.
+  */
+  Forward = Backward = Carried = false;
+  std::unique_ptr<Dependence> D = DI.depends(Src, Dst, true);
+  if (!D)
+    return;
+
+  if (D->isConfused()) {
+    Forward = Backward = Carried = true;
+    return;
+  }
+
+  unsigned Levels = D->getLevels();
+  for (unsigned Level = 1; Level < Levels; Level++)
+    if (!(D->getDirection(Level) & Dependence::DVEntry::EQ))
+      return;
+
+  unsigned Direction = Levels ? D->getDirection(Levels) : unsigned(Dependence::DVEntry::EQ);
+  Forward = Direction & (Dependence::DVEntry::LT | Dependence::DVEntry::EQ);
+  Backward = Direction & Dependence::DVEntry::GT;
+  Carried = Direction & (Dependence::DVEntry::LT | Dependence::DVEntry::GT);
+}
+
+bool buildPartitions(Loop *L, LoopInfo &LI, ScalarEvolution &SE, DependenceInfo &DI,
+                     SmallVectorImpl<Partition> &Partitions, SmallVectorImpl<Instruction *> &Unused,
+                     OptimizationRemarkEmitter &ORE) {
+  /*
+  Divide gli accessi del loop in partizioni e le ordina in modo che ogni dipendenza vada
+  da una partizione a una successiva:
+  1. una load e gli accessi che usano il suo valore devono stare nella stessa partizione;
+  2. le dipendenze tra gli accessi formano un grafo tra questi gruppi, i cui componenti
+     fortemente connessi (dipendenze in entrambe le direzioni) diventano le partizioni;
+  3. le partizioni vengono ordinate topologicamente, mantenendo quando possibile l'ordine
+     del body.
+  Le load il cui valore non arriva a nessuna store sono inutili nelle copie e restano
+  nell'ultimo loop (Unused).
+  */
+  SmallVector<Instruction *, 16> Accesses;
+  DenseMap<Instruction *, unsigned> Position;
+  if (!collectAccesses(L, LI, Accesses, Position))
+    return false;
+
+  // Le copie eseguono lo stesso controllo, che quindi non può dipendere dalla memoria, e
+  // solo l'ultima copia fornisce i valori usati dopo il loop.
+  for (BasicBlock *BB : L->blocks())
+    if (auto *BI = dyn_cast<BranchInst>(BB->getTerminator());
+        !BI or (BI->isConditional() and dependsOnMemory(BI->getCondition(), L)))
+      return false;
+  for (PHINode &PN : L->getExitBlock()->phis())
+    if (dependsOnMemory(PN.getIncomingValue(0), L))
+      return false;
+
+  // 1. Gruppi di accessi legati dai valori letti in memoria.
+  EquivalenceClasses<Instruction *> Groups;
+  for (Instruction *I : Accesses) {
+    Groups.insert(I);
+    SmallPtrSet<Instruction *, 16> Chain;
+    for (Value *Op : I->operands())
+      collectOperandChain(Op, L, Chain);
+    for (Instruction *ChainI : Chain)
+      if (isa<LoadInst>(ChainI))
+        Groups.unionSets(I, ChainI);
+  }
+
+  // Solo i gruppi che contengono una store diventano nodi del grafo.
+  DenseMap<Instruction *, unsigned> NodeOf;
+  SmallVector<Partition, 8> Nodes;
+  for (Instruction *I : Accesses) {
+    Instruction *Leader = Groups.getLeaderValue(I);
+    bool HasStore = any_of(make_range(Groups.findLeader(Leader), Groups.member_end()),
+                           [](Instruction *Member) { return isa<StoreInst>(Member); });
+    if (!HasStore) {
+      Unused.push_back(I);
+      continue;
+    }
+
+    auto [It, Inserted] = NodeOf.try_emplace(Leader, Nodes.size());
+    if (Inserted)
+      Nodes.emplace_back();
+    Partition &Node = Nodes[It->second];
+    NodeOf[I] = It->second;
+
+    Node.Accesses.push_back(I);
+    Node.Streams.insert(SE.getPointerBase(SE.getSCEV(getLoadStorePointerOperand(I))));
+    Node.Vectorizable &= isAffineAccess(I, L, SE) and !usesScalarRecurrence(I, L, SE);
+    Node.FirstPosition = std::min(Node.FirstPosition, Position[I]);
+  }
+
+  unsigned NumNodes = Nodes.size();
+  if (NumNodes < 2) {
+    ORE.emit([&]() {
+      return OptimizationRemarkMissed(DEBUG_TYPE, "SinglePartition", L->getStartLoc(), L->getHeader())
+             << "loop in " << ore::NV("Header", L->getHeader()->getName())
+             << " not distributed: all stores depend on each other's values";
+    });
+    return false;
+  }
+
+  // 2. Archi di dipendenza tra i gruppi e loro chiusura transitiva.
+  SmallVector<BitVector, 8> Reach(NumNodes, BitVector(NumNodes));
+  for (unsigned i = 0; i < Accesses.size(); i++)
+    for (unsigned j = i; j < Accesses.size(); j++) {
+      Instruction *Src = Accesses[i];
+      Instruction *Dst = Accesses[j];
+      if ((!isa<StoreInst>(Src) and !isa<StoreInst>(Dst)) or !NodeOf.count(Src) or !NodeOf.count(Dst))
+        continue;
+
+      bool Forward, Backward, Carried;
+      getDependenceDirections(Src, Dst, DI, Forward, Backward, Carried);
+      unsigned SrcNode = NodeOf[Src], DstNode = NodeOf[Dst];
+
+      // Una dipendenza all'indietro (o di un accesso con se stesso in un'altra iterazione)
+      // all'interno di un gruppo impedisce di vettorizzarlo.
+      if (SrcNode == DstNode) {
+        if (Backward or (Src == Dst and Carried))
+          Nodes[SrcNode].Vectorizable = false;
+        continue;
+      }
+      if (Forward)
+        Reach[SrcNode].set(DstNode);
+      if (Backward)
+        Reach[DstNode].set(SrcNode);
+    }
+
+  for (unsigned k = 0; k < NumNodes; k++)
+    for (unsigned i = 0; i < NumNodes; i++)
+      if (Reach[i].test(k))
+        Reach[i] |= Reach[k];
+
+  // I gruppi che si raggiungono a vicenda formano un componente fortemente connesso: una
+  // dipendenza circolare che li costringe nello stesso loop e impedisce di vettorizzarlo.
+  SmallVector<int, 8> SCCOf(NumNodes, -1);
+  SmallVector<Partition, 8> SCCs;
+  for (unsigned i = 0; i < NumNodes; i++) {
+    if (SCCOf[i] >= 0)
+      continue;
+    SCCOf[i] = SCCs.size();
+    SCCs.push_back(Nodes[i]);
+    for (unsigned j = i + 1; j < NumNodes; j++)
+      if (Reach[i].test(j) and Reach[j].test(i)) {
+        SCCOf[j] = SCCOf[i];
+        SCCs.back().merge(Nodes[j]);
+        SCCs.back().Vectorizable = false;
+      }
+  }
+
+  if (SCCs.size() < 2) {
+    ORE.emit([&]() {
+      return OptimizationRemarkMissed(DEBUG_TYPE, "DependenceCycle", L->getStartLoc(), L->getHeader())
+             << "loop in " << ore::NV("Header", L->getHeader()->getName())
+             << " not distributed: all stores are in one dependence cycle";
+    });
+    return false;
+  }
+
+  // 3. Ordine topologico dei componenti: tra quelli pronti scelgo quello che compare
+  // prima nel body.
+  SmallVector<bool, 8> Placed(SCCs.size(), false);
+  auto isReady = [&](unsigned C) {
+    for (unsigned i = 0; i < NumNodes; i++)
+      for (unsigned j = 0; j < NumNodes; j++)
+        if ((unsigned)SCCOf[j] == C and (unsigned)SCCOf[i] != C and Reach[i].test(j) and !Placed[SCCOf[i]])
+          return false;
+    return true;
+  };
+
+  while (Partitions.size() < SCCs.size()) {
+    int Next = -1;
+    for (unsigned C = 0; C < SCCs.size(); C++)
+      if (!Placed[C] and isReady(C) and (Next < 0 or SCCs[C].FirstPosition < SCCs[Next].FirstPosition))
+        Next = C;
+    Placed[Next] = true;
+    Partitions.push_back(SCCs[Next]);
+  }
+
+  return true;
+}
+
+void selectPartitions(SmallVectorImpl<Partition> &Partitions) {
+  /*
+  Modello di profittabilità: due partizioni consecutive vengono unite se sono entrambe
+  vettorizzabili o entrambe non vettorizzabili, finché il loop risultante accede al massimo
+  a MaxStreams array diversi. Restano quindi separati i flussi vettorizzabili dalle
+  ricorrenze e i loop che accederebbero a troppi array contemporaneamente.
+  Unire partizioni consecutive mantiene valido l'ordine topologico.
+  */
+  SmallVector<Partition, 8> Selected;
+
+  for (Partition &P : Partitions) {
+    if (!Selected.empty() and Selected.back().Vectorizable == P.Vectorizable) {
+      SmallPtrSet<const SCEV *, 8> Streams(Selected.back().Streams.begin(), Selected.back().Streams.end());
+      Streams.insert(P.Streams.begin(), P.Streams.end());
+      if (Streams.size() <= MaxStreams) {
+        Selected.back().merge(P);
+        continue;
+      }
+    }
+    Selected.push_back(P);
+  }
+
+  Partitions.assign(Selected.begin(), Selected.end());
+}
+
+void removeAccesses(Loop *L, ArrayRef<Instruction *> ToRemove) {
+  /*
+  Elimina da una copia del loop gli accessi delle altre partizioni e il codice che
+  serviva solo a loro, comprese le ricorrenze dell'header rimaste senza usi.
+  */
+  SmallVector<WeakTrackingVH, 16> Loads, Dead;
+
+  for (Instruction *I : ToRemove) {
+    if (isa<LoadInst>(I)) {
+      Loads.push_back(I);
+      continue;
+    }
+    for (Value *Op : I->operands())
+      if (isa<Instruction>(Op))
+        Dead.push_back(Op);
+    I->eraseFromParent();
+  }
+  Dead.append(Loads.begin(), Loads.end());
+  RecursivelyDeleteTriviallyDeadInstructionsPermissive(Dead);
+
+  SmallVector<WeakTrackingVH, 8> Phis;
+  for (PHINode &PN : L->getHeader()->phis())
+    Phis.push_back(&PN);
+  for (WeakTrackingVH &VH : Phis)
+    if (auto *PN = dyn_cast_or_null<PHINode>(VH))
+      RecursivelyDeleteDeadPHINode(PN);
+
+  // Le load già eliminate hanno un handle nullo.
+  erase_value(Loads, nullptr);
+  RecursivelyDeleteTriviallyDeadInstructionsPermissive(Loads);
+}
+
+Loop *cloneLoopBefore(Loop *L, ValueToValueMapTy &VMap, LoopInfo &LI, DominatorTree &DT){
+  /*
+  Crea una copia del loop (con il suo preheader) eseguita prima di L: il preheader di L
+  viene diviso e la copia viene inserita tra le due parti.
+  */
+  BasicBlock *OldPreHeader = L->getLoopPreheader();
+  BasicBlock *PreHeader = SplitBlock(OldPreHeader, OldPreHeader->getTerminator(), &DT, &LI);
+  BasicBlock *Exit = L->getExitBlock();
+
+  SmallVector<BasicBlock *, 8> Blocks;
+  Loop *Clone = cloneLoopWithPreheader(PreHeader, OldPreHeader, L, VMap, ".ldist", &LI, &DT, Blocks);
+  remapInstructionsInBlocks(Blocks, VMap);
+
+  // OldPreHeader -> copia -> PreHeader -> L
+  BasicBlock *CloneExiting = Clone->getExitingBlock();
+  OldPreHeader->getTerminator()->replaceSuccessorWith(PreHeader, Clone->getLoopPreheader());
+  CloneExiting->getTerminator()->replaceSuccessorWith(Exit, PreHeader);
+  DT.changeImmediateDominator(PreHeader, CloneExiting);
+
+  return Clone;
+}
+
+void distributeLoop(Loop *L, ArrayRef<Partition> Partitions, ArrayRef<Instruction *> Unused,
+                    LoopInfo &LI, DominatorTree &DT, ScalarEvolution &SE){
+  /*
+  Ogni partizione tranne l'ultima viene eseguita da una copia del loop posta prima di L,
+  nell'ordine delle partizioni, mentre L esegue l'ultima (e le load inutilizzate).
+  In ogni copia restano solo gli accessi della sua partizione. Le espressioni SCEV di L e
+  delle copie vengono dimenticate dopo aver eliminato gli accessi, così ScalarEvolution
+  resta valida.
+  */
+  SmallVector<Instruction *, 16> AllAccesses(Unused.begin(), Unused.end());
+  for (const Partition &P : Partitions)
+    AllAccesses.append(P.Accesses.begin(), P.Accesses.end());
+
+  for (const Partition &P : Partitions.drop_back()) {
+    ValueToValueMapTy VMap;
+    Loop *Clone = cloneLoopBefore(L, VMap, LI, DT);
+
+    SmallVector<Instruction *, 16> ToRemove;
+    for (Instruction *I : AllAccesses)
+      if (!is_contained(P.Accesses, I))
+        ToRemove.push_back(cast<Instruction>(VMap[I]));
+    removeAccesses(Clone, ToRemove);
+    SE.forgetLoop(Clone);
+  }
+
+  SmallVector<Instruction *, 16> ToRemove;
+  for (const Partition &P : Partitions.drop_back())
+    ToRemove.append(P.Accesses.begin(), P.Accesses.end());
+  removeAccesses(L, ToRemove);
+  SE.forgetLoop(L);
+}
+
+PreservedAnalyses LoopDistribution::run(Function &F, FunctionAnalysisManager &AM) {
+
+  // Dichiaro e creo tutti gli strumenti di analisi che andrò ad utilizzare e passare alle funzioni.
+  LoopInfo &LI = AM.getResult<LoopAnalysis>(F);
+  DominatorTree &DT = AM.getResult<DominatorTreeAnalysis>(F);
+  ScalarEvolution &SE = AM.getResult<ScalarEvolutionAnalysis>(F);
+  DependenceInfo &DI = AM.getResult<DependenceAnalysis>(F);
+  OptimizationRemarkEmitter &ORE = AM.getResult<OptimizationRemarkEmitterAnalysis>(F);
+
+  // Le copie create vengono aggiunte al LoopInfo: raccolgo prima i loop da visitare.
+  SmallVector<Loop *, 8> Worklist;
+  for (Loop *L : LI.getLoopsInPreorder())
+    if (isDistributionCandidate(L, DT))
+      Worklist.push_back(L);
+
+  bool Changed = false;
+  for (Loop *L : Worklist) {
+    SmallVector<Partition, 8> Partitions;
+    SmallVector<Instruction *, 8> Unused;
+    if (!buildPartitions(L, LI, SE, DI, Partitions, Unused, ORE))
+      continue;
+
+    unsigned NumSCCs = Partitions.size();
+    selectPartitions(Partitions);
+    if (Partitions.size() < 2) {
+      ORE.emit([&]() {
+        return OptimizationRemarkMissed(DEBUG_TYPE, "NotProfitable", L->getStartLoc(), L->getHeader())
+               << "loop in " << ore::NV("Header", L->getHeader()->getName()) << " not distributed: "
+               << ore::NV("Partitions", NumSCCs)
+               << " partitions have the same vectorizability and few memory streams";
+      });
+      continue;
+    }
+
+    // Gli accessi di L cambiano: le espressioni SCEV calcolate per L non sono più valide.
+    SE.forgetLoop(L);
+    distributeLoop(L, Partitions, Unused, LI, DT, SE);
+
+    NumDistributed++;
+    NumLoopsCreated += Partitions.size() - 1;
+    Changed = true;
+    ORE.emit([&]() {
+      return OptimizationRemark(DEBUG_TYPE, "Distributed", L->getStartLoc(), L->getHeader())
+             << "loop in " << ore::NV("Header", L->getHeader()->getName()) << " distributed into "
+             << ore::NV("Loops", (unsigned)Partitions.size()) << " loops";
+    });
+  }
+
+  if (!Changed)
+    return PreservedAnalyses::all();
+
+  // Le copie vengono aggiunte al LoopInfo e al dominator tree durante la distribuzione.
+  PreservedAnalyses PA;
+  PA.preserve<DominatorTreeAnalysis>();
+  PA.preserve<LoopAnalysis>();
+  PA.preserve<ScalarEvolutionAnalysis>();
+  return PA;
+}
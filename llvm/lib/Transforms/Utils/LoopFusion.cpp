@@ -1,9 +1,48 @@
 #include "llvm/Transforms/Utils/LoopFusion.h"
 #include <set>
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Analysis/DependenceAnalysis.h"
+#include "llvm/Analysis/DomTreeUpdater.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Analysis/VectorUtils.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/LoopUtils.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
 using namespace llvm;
 
+#define DEBUG_TYPE "my-loop-fusion"
+
+STATISTIC(NumFused, "Number of loops fused");
+STATISTIC(NumNotCFE, "Number of loop pairs not control flow equivalent");
+STATISTIC(NumNotAdjacent, "Number of loop pairs not adjacent");
+STATISTIC(NumIncompatibleControlFlow, "Number of loop pairs with different exits or guards");
+STATISTIC(NumTripCountMismatch, "Number of loop pairs with different trip counts");
+STATISTIC(NumNotConformantNest, "Number of loop nest pairs with different shapes");
+STATISTIC(NumNegativeDistance, "Number of loop pairs with negative dependence distance");
+STATISTIC(NumScalarDependence, "Number of loop pairs where L2 uses values computed in L1");
+STATISTIC(NumFusionFailed, "Number of loop pairs whose fusion failed");
+STATISTIC(NumPeeled, "Number of loops peeled to align trip counts");
+STATISTIC(NumParallel, "Number of fused loops annotated with parallel accesses");
+
+static cl::opt<unsigned> MaxPeelCount(
+    "my-loop-fusion-max-peel", cl::init(3), cl::Hidden,
+    cl::desc("Maximum number of iterations peeled from the longer loop of a "
+             "pair to align the trip counts before fusion"));
+
+static cl::opt<bool> EmitParallelMetadata(
+    "my-loop-fusion-parallel-metadata", cl::init(true), cl::Hidden,
+    cl::desc("Annotate fused loops whose accesses are proven independent across "
+             "iterations with llvm.loop.parallel_accesses and vectorize hints"));
+
 bool areControlFlowEquivalent(BasicBlock *BB0, BasicBlock *BB1, DominatorTree &DT,PostDominatorTree &PDT) {
   /*
   Due loop sono CFE se L0 domina L1 e L1 postdomina L0 allora i due loop sono CFE equivalenti
@@ -25,34 +64,147 @@ BasicBlock *getEntryBlock(Loop *L) {
   return (L->isGuarded() ? getGuard(L) : L->getLoopPreheader());
 }
 
+bool canMoveBeforeLoop(Instruction &I, Loop *L, ArrayRef<BasicBlock *> Between) {
+  /*
+  Un'istruzione che si trova tra due loop può essere anticipata prima del primo se non
+  accede alla memoria, non ha side effect e non usa valori calcolati dal loop (compresi
+  i phi dei blocchi tra i due loop, che uniscono i risultati del loop).
+  */
+  if (I.mayReadOrWriteMemory() or I.mayHaveSideEffects() or !isSafeToSpeculativelyExecute(&I))
+    return false;
+
+  for (Value *Op : I.operands())
+    if (Instruction *OpI = dyn_cast<Instruction>(Op))
+      if (L->contains(OpI) or (isa<PHINode>(OpI) and is_contained(Between, OpI->getParent())))
+        return false;
+
+  return true;
+}
+
+BasicBlock *getGuardSkipBlock(Loop *L) {
+  /*
+  Restituisce il successore della guardia che salta il loop.
+  */
+  BranchInst *GuardBI = L->getLoopGuardBranch();
+  return GuardBI->getSuccessor(GuardBI->getSuccessor(0) == L->getLoopPreheader() ? 1 : 0);
+}
+
+bool getBlocksBetween(Loop *L1, Loop *L2, SmallVectorImpl<BasicBlock *> &Between) {
+  /*
+  Raccoglie i blocchi che vanno dall'exit block di L1 al preheader di L2 (compresi).
+  Devono formare una catena di salti incondizionati e il loro codice deve poter essere
+  spostato: i phi LCSSA dell'exit block di L1 (che non devono essere usati da L2) e
+  istruzioni che possono essere anticipate prima di L1, come gli invarianti di L2 che
+  la LICM ha spostato nel suo preheader.
+  Se i loop hanno entrambi la guardia, la catena passa per il blocco in cui si uniscono
+  l'uscita di L1 e il salto della sua guardia (dove possono esserci altri phi con i
+  risultati di L1) e per la guardia di L2.
+  */
+  BranchInst *Guard1 = L1->getLoopGuardBranch();
+  BranchInst *Guard2 = L2->getLoopGuardBranch();
+  if (!Guard1 != !Guard2)
+    return false;
+
+  BasicBlock *Exit = L1->getExitBlock();
+  BasicBlock *L2PreHeader = L2->getLoopPreheader();
+  BasicBlock *Skip1 = Guard1 ? getGuardSkipBlock(L1) : nullptr;
+  if (Guard2 and !getGuardSkipBlock(L2)->hasNPredecessors(2))
+    return false;
+
+  BasicBlock *BB = Exit;
+  bool SkipReached = !Guard1;
+
+  while (true) {
+    Between.push_back(BB);
+    SkipReached |= BB == Skip1;
+
+    for (Instruction &I : *BB) {
+      if (I.isTerminator())
+        continue;
+
+      if (PHINode *PN = dyn_cast<PHINode>(&I)) {
+        if (BB != Exit and BB != Skip1)
+          return false;
+        for (User *U : PN->users())
+          if (L2->contains(cast<Instruction>(U)))
+            return false;
+      } else if (!SkipReached or !canMoveBeforeLoop(I, L1, Between))
+        // Prima del blocco di unione il codice viene eseguito solo se L1 viene eseguito. 
+        return false;
+    }
+
+    if (BB == L2PreHeader)
+      return SkipReached;
+
+    BasicBlock *Succ = (Guard2 and BB == Guard2->getParent()) ? L2PreHeader : BB->getSingleSuccessor();
+    if (!Succ or (Succ == Skip1 ? !Succ->hasNPredecessors(2) : !Succ->getSinglePredecessor()))
+      return false;
+    BB = Succ;
+  }
+}
+
 bool areAdjacent(Loop *L1, Loop *L2) {
   /*
   Due loop sono adiacenti se non ci sono basic blocks aggiuntivi nel CFG tra l'uscita del primo
   e l'inizio dell'altro. 
 
-  - Se i loop sono guarded il successore non loop del guard branch di L0 deve essere l'entry Block
-  - Se i loop NON sono guarded l'exit block di L0 deve essere il pre-header di L1 
+  - Se i loop NON sono guarded l'exit block di L0 deve portare al pre-header di L1, passando
+    solo per blocchi senza codice da eseguire tra i due loop (vedi getBlocksBetween)
+  - Se i loop sono guarded anche il successore non loop della guardia di L0 deve portare,
+    con gli stessi blocchi, alla guardia di L1
+  */
+  SmallVector<BasicBlock *, 4> Between;
+  return getBlocksBetween(L1, L2, Between);
+}
+
+bool exitsFromLatch(Loop *L) {
+  /*
+  Un loop ruotato (do-while, come quelli prodotti da loop-rotate) esce dal latch, mentre un
+  loop nella forma for/while esce dall'header.
+  */
+  return L->getExitingBlock() == L->getLoopLatch();
+}
+
+bool areEquivalentConditions(Value *C1, Value *C2, ScalarEvolution &SE) {
+  /*
+  Due condizioni sono equivalenti se sono lo stesso valore oppure due confronti con lo
+  stesso predicato tra operandi con la stessa espressione SCEV (es. due icmp sgt %n, 0
+  calcolate prima dei due loop).
   */
-  BasicBlock *BB2ToCheck = getEntryBlock(L2);
+  if (C1 == C2)
+    return true;
 
-  if (L1->isGuarded()) {
-    // Se ha la guardia controllo che l'ultima istruzione di Branch 
-    // della guardia jumpi all'entry block del loop 2. 
+  auto *Cmp1 = dyn_cast<ICmpInst>(C1);
+  auto *Cmp2 = dyn_cast<ICmpInst>(C2);
+  if (!Cmp1 or !Cmp2 or !SE.isSCEVable(Cmp1->getOperand(0)->getType()) or
+      Cmp1->getOperand(0)->getType() != Cmp2->getOperand(0)->getType())
+    return false;
 
-    BasicBlock *GuardBB = getGuard(L1);
-    BranchInst *GuardBI = dyn_cast<BranchInst>(GuardBB->getTerminator());
+  const SCEV *LHS1 = SE.getSCEV(Cmp1->getOperand(0)), *RHS1 = SE.getSCEV(Cmp1->getOperand(1));
+  const SCEV *LHS2 = SE.getSCEV(Cmp2->getOperand(0)), *RHS2 = SE.getSCEV(Cmp2->getOperand(1));
+  if (Cmp1->getPredicate() == Cmp2->getPredicate())
+    return LHS1 == LHS2 and RHS1 == RHS2;
+  return Cmp1->getPredicate() == Cmp2->getSwappedPredicate() and LHS1 == RHS2 and RHS1 == LHS2;
+}
 
-    if (!GuardBI /*|| GuardBI->isUnconditional()*/)
-      return false;
+bool haveCompatibleControlFlow(Loop *L1, Loop *L2, ScalarEvolution &SE) {
+  /*
+  I due loop devono uscire dallo stesso punto (entrambi dall'header o entrambi dal latch)
+  e, se hanno la guardia, le due guardie devono essere equivalenti: con lo stesso trip
+  count la guardia di L2 viene eliminata e resta solo quella di L1.
+  */
+  if (exitsFromLatch(L1) != exitsFromLatch(L2))
+    return false;
 
-    return GuardBI->getSuccessor(1) == BB2ToCheck or
-           GuardBI->getSuccessor(0) == BB2ToCheck;
+  BranchInst *Guard1 = L1->getLoopGuardBranch();
+  BranchInst *Guard2 = L2->getLoopGuardBranch();
+  if (!Guard1 or !Guard2)
+    return !Guard1 and !Guard2;
 
-  } else {
-    // Se non ha la guardia l'exit block di L1 deve corrispondere all'entry block di L2 
-    // (che può essere la sua guardia o il pre header)
-    return L1->getExitBlock() == BB2ToCheck;
-  }
+  // Il preheader deve trovarsi sullo stesso lato delle due guardie. 
+  return (Guard1->getSuccessor(0) == L1->getLoopPreheader()) ==
+             (Guard2->getSuccessor(0) == L2->getLoopPreheader()) and
+         areEquivalentConditions(Guard1->getCondition(), Guard2->getCondition(), SE);
 }
 
 const SCEV* getTripCount(Loop *L, ScalarEvolution &SE){
@@ -68,13 +220,62 @@ bool isSameTripCount(Loop *L1, Loop *L2, ScalarEvolution &SE){
   /*
   Funzione che controlla che i due loop abbiano lo stesso trip count.
   */
-  return getTripCount(L1, SE) == getTripCount(L2, SE);
+  const SCEV *TripCount = getTripCount(L1, SE);
+  return !isa<SCEVCouldNotCompute>(TripCount) and TripCount == getTripCount(L2, SE);
+}
+
+bool getPerfectNest(Loop *L, SmallVectorImpl<Loop *> &Nest) {
+  /*
+  Raccoglie i loop del nest che ha L come loop più esterno, dall'esterno verso l'interno.
+  Restituisce false se il nest non è perfettamente annidato: ogni loop deve avere un solo
+  sottoloop e, fuori dal sottoloop, nessuna istruzione che accede alla memoria o ha
+  side effect (tutti gli accessi sono nel loop più interno).
+  */
+  Nest.push_back(L);
+
+  while (!L->isInnermost()) {
+    if (L->getSubLoops().size() != 1)
+      return false;
+
+    Loop *Inner = L->getSubLoops().front();
+    for (BasicBlock *BB : L->blocks())
+      if (!Inner->contains(BB))
+        for (Instruction &I : *BB)
+          if (I.mayReadOrWriteMemory() or I.mayHaveSideEffects())
+            return false;
+
+    Nest.push_back(Inner);
+    L = Inner;
+  }
+
+  return true;
+}
+
+bool areConformantNests(Loop *L1, Loop *L2, ScalarEvolution &SE,
+                        SmallVectorImpl<Loop *> &Nest1, SmallVectorImpl<Loop *> &Nest2) {
+  /*
+  Due nest possono essere fusi livello per livello se sono perfettamente annidati, hanno
+  la stessa profondità e ad ogni livello i loop hanno lo stesso trip count.
+  Per due loop senza sottoloop i nest contengono solo L1 e L2.
+  Il trip count dei loop più esterni viene controllato a parte, perché può essere
+  allineato con il peeling (vedi getPeelCount): questo controllo non dipende dal peeling
+  e può essere eseguito prima.
+  */
+  if (!getPerfectNest(L1, Nest1) or !getPerfectNest(L2, Nest2) or Nest1.size() != Nest2.size())
+    return false;
+
+  for (unsigned Level = 1; Level < Nest1.size(); Level++)
+    if (!isSameTripCount(Nest1[Level], Nest2[Level], SE))
+      return false;
+
+  return true;
 }
 
 BasicBlock * getBody(Loop *L){
   /*
   Funzione che recupera il body del loop che corrisponderà al blocco successivo all'header 
-  e che, allo stesso tempo, apparterà al loop. 
+  e che, allo stesso tempo, apparterà al loop. È il primo blocco del body, che può
+  continuare con altri blocchi (if/else, sottoloop...) fino al latch.
   */
   BranchInst *HeaderBI = dyn_cast<BranchInst>(L->getHeader()->getTerminator());
   if (!HeaderBI)
@@ -92,59 +293,328 @@ BasicBlock * getBody(Loop *L){
   return nullptr;
 }
 
-bool haveNegativeDistance(Loop *L1, Loop *L2, DependenceInfo &DI){
+bool collectMemoryAccesses(Loop *L, SmallVectorImpl<Instruction *> &Accesses) {
   /*
-  BasicBlock *Loop1Body = getBody(L1);
-  BasicBlock *Loop2Body = getBody(L2);
-  
-  std::list<Instruction *> storeInstLoop1;
-
-  for(auto &instLoop1 : *Loop1Body)
-  {
-    if(isa<StoreInst>(instLoop1))
-    {
-      for (auto operandStore = instLoop1.op_begin(); operandStore != instLoop1.op_end(); operandStore++)
-      {
-        Instruction *IStore = dyn_cast<Instruction>(*operandStore);
-        if (auto *GEPStore = dyn_cast<GetElementPtrInst>(IStore))
-        {
-          Value *ptrStore = GEPStore->getPointerOperand();
-          outs() << instLoop1 << " scrive nell'array ";
-          ptrStore->print(outs());
-          outs() << "\n";
-
-          for(auto &instLoop2 : *Loop2Body)
-          {
-            if(isa<LoadInst>(instLoop2))
-            {
-              for (auto operandLoad = instLoop2.op_begin(); operandLoad != instLoop2.op_end(); operandLoad++)
-              {
-                Instruction *ILoad = dyn_cast<Instruction>(*operandLoad);
-                if (auto *GEPLoad = dyn_cast<GetElementPtrInst>(ILoad))
-                {
-                  Value *ptrLoad = GEPLoad->getPointerOperand();
-                  outs() << instLoop2 << " legge dall'array ";
-                  ptrLoad->print(outs());
-                  outs() << "\n";
-                  if(ptrLoad == ptrStore)
-                  {
-                    outs() << " Scrivono e leggono dallo stesso array\n";
-                    if(std::unique_ptr< Dependence > DIobj = DI.depends(&instLoop2, &instLoop1,true))
-                    {
-
-                      outs() << "Dipendono";
-                    }
-                                       
-                  }
-                }
-              }
-            }
-          }
-        }
+  Funzione che raccoglie le load e le store del loop. Restituisce false se nel loop
+  c'è un'altra istruzione che accede alla memoria (call, load/store volatili o
+  atomiche...), per cui non è possibile analizzare le dipendenze.
+  */
+  for (BasicBlock *BB : L->blocks())
+    for (Instruction &I : *BB) {
+      if (!I.mayReadOrWriteMemory())
+        continue;
+
+      LoadInst *Load = dyn_cast<LoadInst>(&I);
+      StoreInst *Store = dyn_cast<StoreInst>(&I);
+      if (!(Load and Load->isSimple()) and !(Store and Store->isSimple()))
+        return false;
+
+      Accesses.push_back(&I);
+    }
+  return true;
+}
+
+bool getAccessSteps(const SCEV *S, ArrayRef<Loop *> Nest, ScalarEvolution &SE,
+                    const SCEV *&Start, SmallVectorImpl<const SCEV *> &Steps) {
+  /*
+  Scompone l'indirizzo di un accesso del nest nella forma
+  {...{Start,+,S0}<Nest[0]>...,+,Sn}<Nest[n]> e restituisce Start e i passi di ogni
+  livello, dal loop più esterno al più interno.
+  */
+  Steps.assign(Nest.size(), nullptr);
+
+  for (unsigned Level = Nest.size(); Level-- > 0;) {
+    auto *AR = dyn_cast<SCEVAddRecExpr>(S);
+    if (!AR or AR->getLoop() != Nest[Level] or !AR->isAffine())
+      return false;
+
+    Steps[Level] = AR->getStepRecurrence(SE);
+    S = AR->getStart();
+  }
+
+  Start = S;
+  return true;
+}
+
+bool isLexicographicNest(ArrayRef<Loop *> Nest, ArrayRef<const SCEV *> Steps, ScalarEvolution &SE) {
+  /*
+  Controlla che gli indirizzi crescano con l'ordine (lessicografico) delle iterazioni del
+  nest: i passi devono essere positivi e ad ogni livello il passo deve coprire tutte le
+  iterazioni del livello interno (es. A[i][j] con j < M: passo di i = M * passo di j).
+  In questo caso tra due iterazioni consecutive la distanza è almeno il passo del loop
+  più interno.
+  */
+  for (unsigned Level = 0; Level < Nest.size(); Level++) {
+    if (!SE.isKnownPositive(Steps[Level]))
+      return false;
+
+    if (Level + 1 == Nest.size())
+      break;
+
+    const SCEV *TripCount = getTripCount(Nest[Level + 1], SE);
+    if (isa<SCEVCouldNotCompute>(TripCount))
+      return false;
+
+    TripCount = SE.getTruncateOrZeroExtend(TripCount, Steps[Level]->getType());
+    if (!SE.isKnownPredicate(ICmpInst::ICMP_SGE, Steps[Level],
+                             SE.getMulExpr(TripCount, Steps[Level + 1])))
+      return false;
+  }
+
+  return true;
+}
+
+bool isFusionSafeAccessPair(Instruction *I1, Instruction *I2, ArrayRef<Loop *> Nest1,
+                            ArrayRef<Loop *> Nest2, unsigned PeelCount1, DependenceInfo &DI,
+                            ScalarEvolution &SE) {
+  /*
+  Funzione che controlla che la fusione rispetti le dipendenze tra un accesso di L1
+  e uno di L2 (almeno uno dei due è una store).
+  Dopo la fusione l'iterazione i di L2 viene eseguita prima delle iterazioni j > i
+  di L1: se L2 all'iterazione i accede a una locazione usata da L1 in un'iterazione
+  successiva (distanza negativa) la fusione non è legale, mentre con distanza nulla
+  o positiva l'ordine degli accessi viene mantenuto.
+  Nei casi che non è possibile analizzare la risposta è conservativa (false).
+  Se le prime PeelCount1 iterazioni di L1 verranno tolte con il peeling, l'iterazione i
+  di L1 accederà agli indirizzi dell'attuale iterazione i + PeelCount1. Il peeling riduce
+  solo le iterazioni di L1, quindi le risposte di DependenceInfo restano valide.
+  */
+  std::unique_ptr<Dependence> Dep = DI.depends(I1, I2, true);
+
+  // DependenceInfo dimostra che non c'è dipendenza. 
+  if (!Dep)
+    return true;
+
+  // Direction vector dei loop che contengono sia L1 che L2: se in uno di questi
+  // livelli la direzione esclude "=" la dipendenza collega iterazioni diverse di
+  // un loop esterno e la fusione (che riordina solo le iterazioni di L1 e L2
+  // all'interno della stessa iterazione esterna) non la modifica. 
+  if (!Dep->isConfused())
+    for (unsigned Level = 1; Level <= Dep->getLevels(); Level++)
+      if (!(Dep->getDirection(Level) & Dependence::DVEntry::EQ))
+        return true;
+
+  // Distanza nel loop fuso: gli indirizzi devono essere {A,+,Step}<L1> e
+  // {B,+,Step}<L2> (stesso Step), così l'iterazione i di L2 accede alla locazione
+  // usata da L1 all'iterazione j = i + (B - A) / Step. Per due nest ogni livello
+  // deve avere lo stesso passo in entrambi gli indirizzi. 
+  const SCEV *Start1, *Start2;
+  SmallVector<const SCEV *, 4> Steps1, Steps2;
+  if (!getAccessSteps(SE.getSCEV(getLoadStorePointerOperand(I1)), Nest1, SE, Start1, Steps1) or
+      !getAccessSteps(SE.getSCEV(getLoadStorePointerOperand(I2)), Nest2, SE, Start2, Steps2) or
+      Steps1 != Steps2)
+    return false;
+
+  if (PeelCount1)
+    Start1 = SE.getAddExpr(Start1, SE.getMulExpr(Steps1.front(),
+                                                 SE.getConstant(Steps1.front()->getType(), PeelCount1)));
+
+  const SCEV *Step = Steps1.back();
+  const SCEV *Diff = SE.getMinusSCEV(Start2, Start1);
+  if (isa<SCEVCouldNotCompute>(Diff) or Diff->getType() != Step->getType())
+    return false;
+
+  const DataLayout &DL = I1->getModule()->getDataLayout();
+  uint64_t Size1 = DL.getTypeStoreSize(getLoadStoreType(I1));
+  uint64_t Size2 = DL.getTypeStoreSize(getLoadStoreType(I2));
+
+  // Con Step > 0 l'accesso di L2 all'iterazione i non deve sovrapporsi a quello di
+  // L1 all'iterazione i + 1:  B + i*Step + Size2 <= A + (i+1)*Step
+  //                           B - A <= Step - Size2
+  // Nei nest vale lo stesso controllo se gli indirizzi seguono l'ordine delle iterazioni. 
+  if (SE.isKnownPositive(Step) and isLexicographicNest(Nest1, Steps1, SE))
+    return SE.isKnownNonPositive(SE.getMinusSCEV(
+        Diff, SE.getMinusSCEV(Step, SE.getConstant(Step->getType(), Size2))));
+
+  // Con Step < 0, simmetricamente:  A + (i+1)*Step + Size1 <= B + i*Step
+  //                                 B - A >= Step + Size1
+  if (Nest1.size() == 1 and SE.isKnownNegative(Step))
+    return SE.isKnownNonNegative(SE.getMinusSCEV(
+        Diff, SE.getAddExpr(Step, SE.getConstant(Step->getType(), Size1))));
+
+  return false;
+}
+
+bool haveNegativeDistance(ArrayRef<Loop *> Nest1, ArrayRef<Loop *> Nest2, unsigned PeelCount1,
+                          DependenceInfo &DI, ScalarEvolution &SE){
+  /*
+  Funzione che controlla le dipendenze tra ogni coppia di accessi in memoria dei nest
+  di L1 e L2 (escluse le coppie di sole load). Restituisce true se almeno una dipendenza
+  ha distanza negativa oppure non può essere analizzata. PeelCount1 è il numero di
+  iterazioni che verranno tolte all'inizio di L1 per allinearne il trip count.
+  */
+  SmallVector<Instruction *, 16> Accesses1, Accesses2;
+  if (!collectMemoryAccesses(Nest1.front(), Accesses1) or
+      !collectMemoryAccesses(Nest2.front(), Accesses2)) {
+    LLVM_DEBUG(dbgs() << "Accessi in memoria non analizzabili.\n");
+    return true;
+  }
+
+  for (Instruction *I1 : Accesses1)
+    for (Instruction *I2 : Accesses2) {
+      if (!I1->mayWriteToMemory() and !I2->mayWriteToMemory())
+        continue;
+
+      if (!isFusionSafeAccessPair(I1, I2, Nest1, Nest2, PeelCount1, DI, SE)) {
+        LLVM_DEBUG(dbgs() << "Dipendenza con distanza negativa tra " << *I1
+                          << " e " << *I2 << "\n");
+        return true;
       }
     }
-    */
-   return false;
+
+  return false;
+}
+
+bool usesValuesFromLoop(Loop *L2, Loop *L1){
+  /*
+  Funzione che controlla se un'istruzione di L2 (o dei suoi sottoloop) usa direttamente un
+  valore calcolato in L1, come succede quando l'IR non è in forma LCSSA. Dopo la fusione
+  L2 vedrebbe il valore dell'iterazione corrente di L1 invece di quello finale, sia
+  quando l'header di L2 viene eliminato sia quando i loop ruotati vengono uniti nel
+  latch. In forma LCSSA lo stesso uso passa per un phi dell'exit block di L1, che viene
+  già rifiutato da getBlocksBetween.
+  */
+  for (BasicBlock *BB : L2->blocks())
+    for (Instruction &I : *BB)
+      for (Value *Op : I.operands())
+        if (auto *OpI = dyn_cast<Instruction>(Op))
+          if (L1->contains(OpI)) {
+            LLVM_DEBUG(dbgs() << "L2 usa un valore di L1: " << I << "\n");
+            return true;
+          }
+
+  return false;
+}
+
+bool isIterationLocalDependence(Instruction *I1, Instruction *I2, DependenceInfo &DI) {
+  /*
+  Controlla che I1 e I2, nello stesso loop interno, non abbiano una dipendenza tra
+  iterazioni diverse del loop: la dipendenza non esiste, collega iterazioni diverse
+  di un loop esterno oppure ha direzione "=" nel loop interno.
+  */
+  std::unique_ptr<Dependence> Dep = DI.depends(I1, I2, true);
+  if (!Dep)
+    return true;
+  if (Dep->isConfused() or Dep->getLevels() == 0)
+    return false;
+
+  unsigned Levels = Dep->getLevels();
+  for (unsigned Level = 1; Level < Levels; Level++)
+    if (!(Dep->getDirection(Level) & Dependence::DVEntry::EQ))
+      return true;
+
+  return Dep->getDirection(Levels) == Dependence::DVEntry::EQ;
+}
+
+bool isSameIterationAccessPair(Instruction *I1, Instruction *I2, Loop *L1, Loop *L2,
+                               DependenceInfo &DI, ScalarEvolution &SE) {
+  /*
+  Versione di isIterationLocalDependence per un accesso di L1 e uno di L2: DependenceInfo
+  non conosce il loop fuso, quindi si confrontano gli indirizzi {A,+,Step}<L1> e
+  {B,+,Step}<L2>. Dopo la fusione la dipendenza resta nella stessa iterazione solo se
+  i due accessi usano la stessa locazione (A = B, stessa dimensione).
+  */
+  std::unique_ptr<Dependence> Dep = DI.depends(I1, I2, true);
+  if (!Dep)
+    return true;
+
+  if (!Dep->isConfused())
+    for (unsigned Level = 1; Level <= Dep->getLevels(); Level++)
+      if (!(Dep->getDirection(Level) & Dependence::DVEntry::EQ))
+        return true;
+
+  const SCEV *Start1, *Start2;
+  SmallVector<const SCEV *, 1> Steps1, Steps2;
+  if (!getAccessSteps(SE.getSCEV(getLoadStorePointerOperand(I1)), {L1}, SE, Start1, Steps1) or
+      !getAccessSteps(SE.getSCEV(getLoadStorePointerOperand(I2)), {L2}, SE, Start2, Steps2) or
+      Steps1 != Steps2 or Start1 != Start2)
+    return false;
+
+  return getLoadStoreType(I1) == getLoadStoreType(I2);
+}
+
+bool areFusedAccessesParallel(Loop *L1, Loop *L2, DependenceInfo &DI, ScalarEvolution &SE) {
+  /*
+  Funzione che controlla, prima della fusione di due loop interni, che nel loop fuso
+  nessuna coppia di accessi (con almeno una store) abbia una dipendenza tra iterazioni
+  diverse: le coppie dello stesso loop con DependenceInfo, quelle tra L1 e L2 con gli
+  indirizzi. In questo caso le iterazioni del loop fuso possono essere eseguite in
+  parallelo e il vettorizzatore non ha bisogno di controlli a runtime.
+  */
+  SmallVector<Instruction *, 16> Accesses1, Accesses2;
+  if (!L1->isInnermost() or !L2->isInnermost() or
+      !collectMemoryAccesses(L1, Accesses1) or !collectMemoryAccesses(L2, Accesses2))
+    return false;
+
+  for (ArrayRef<Instruction *> Accesses : {ArrayRef<Instruction *>(Accesses1), ArrayRef<Instruction *>(Accesses2)})
+    for (unsigned i = 0; i < Accesses.size(); i++)
+      for (unsigned j = i; j < Accesses.size(); j++)
+        if ((Accesses[i]->mayWriteToMemory() or Accesses[j]->mayWriteToMemory()) and
+            !isIterationLocalDependence(Accesses[i], Accesses[j], DI))
+          return false;
+
+  for (Instruction *I1 : Accesses1)
+    for (Instruction *I2 : Accesses2)
+      if ((I1->mayWriteToMemory() or I2->mayWriteToMemory()) and
+          !isSameIterationAccessPair(I1, I2, L1, L2, DI, SE))
+        return false;
+
+  return true;
+}
+
+bool hasOnlyInductionPhis(Loop *L, ScalarEvolution &SE) {
+  /*
+  Controlla che tutti i phi dell'header siano induction variable affini del loop. Le altre
+  ricorrenze (es. a = a * 31 + A[i]) possono impedire la vettorizzazione anche se gli
+  accessi sono indipendenti: in quel caso forzarla produrrebbe solo un warning.
+  */
+  for (PHINode &PN : L->getHeader()->phis()) {
+    auto *AR = SE.isSCEVable(PN.getType()) ? dyn_cast<SCEVAddRecExpr>(SE.getSCEV(&PN)) : nullptr;
+    if (!AR or AR->getLoop() != L or !AR->isAffine())
+      return false;
+  }
+  return true;
+}
+
+void annotateParallelLoop(Loop *L, MDNode *OrigLoopID, bool AddVectorizeHints,
+                          const TargetTransformInfo &TTI){
+  /*
+  Aggiunge al loop fuso i metadati llvm.loop: tutti gli accessi in memoria vengono
+  inseriti in un nuovo access group elencato in llvm.loop.parallel_accesses e, se il
+  loop non ha già indicazioni per il vettorizzatore, vengono aggiunti
+  llvm.loop.vectorize.enable e llvm.loop.vectorize.width. La larghezza è il numero di
+  elementi del tipo più grande acceduto che stanno in un registro vettoriale.
+  */
+  LLVMContext &Ctx = L->getHeader()->getContext();
+  const DataLayout &DL = L->getHeader()->getModule()->getDataLayout();
+  MDNode *AccessGroup = MDNode::getDistinct(Ctx, {});
+  uint64_t MaxBits = 0;
+
+  for (BasicBlock *BB : L->blocks())
+    for (Instruction &I : *BB)
+      if (I.mayReadOrWriteMemory()) {
+        I.setMetadata(LLVMContext::MD_access_group,
+                      uniteAccessGroups(I.getMetadata(LLVMContext::MD_access_group), AccessGroup));
+        if (Type *Ty = getLoadStoreType(&I))
+          MaxBits = std::max<uint64_t>(MaxBits, DL.getTypeSizeInBits(Ty).getKnownMinValue());
+      }
+
+  SmallVector<MDNode *, 3> Attrs = {
+      MDNode::get(Ctx, {MDString::get(Ctx, "llvm.loop.parallel_accesses"), AccessGroup})};
+
+  if (AddVectorizeHints) {
+    Attrs.push_back(MDNode::get(Ctx, {MDString::get(Ctx, "llvm.loop.vectorize.enable"),
+                                      ConstantAsMetadata::get(ConstantInt::getTrue(Ctx))}));
+
+    uint64_t RegisterBits =
+        TTI.getRegisterBitWidth(TargetTransformInfo::RGK_FixedWidthVector).getKnownMinValue();
+    if (MaxBits and RegisterBits / MaxBits >= 2)
+      Attrs.push_back(MDNode::get(
+          Ctx, {MDString::get(Ctx, "llvm.loop.vectorize.width"),
+                ConstantAsMetadata::get(ConstantInt::get(Type::getInt32Ty(Ctx), RegisterBits / MaxBits))}));
+  }
+
+  L->setLoopID(makePostTransformationMetadata(Ctx, OrigLoopID, {"llvm.loop.parallel_accesses"}, Attrs));
 }
 
 bool isOkForFusion(Loop *L){
@@ -154,6 +624,12 @@ bool isOkForFusion(Loop *L){
   */
   if (!L->getLoopPreheader() or !L->getHeader() or !L->getLoopLatch() or !L->getExitingBlock() or !L->getExitBlock())
     return false;
+
+  /*
+  Il loop deve uscire dall'header o dal latch (vedi exitsFromLatch)
+  */
+  if (L->getExitingBlock() != L->getHeader() and !exitsFromLatch(L))
+    return false;
   
   /*
   Controllo che il loop sia in forma normale
@@ -164,164 +640,848 @@ bool isOkForFusion(Loop *L){
   return true;
 }
 
-bool replaceUsesIV(Loop *L1, Loop *L2){
+void shiftInductionVariable(Loop *L, PHINode *IV, Value *Offset){
   /*
-  Rimpiazza gli usi dell'iteration variable del loop 2 con quella del loop 1.
+  Sostituisce gli usi della IV canonica con IV + Offset, calcolato nell'header. La IV
+  riceve un nuovo incremento nel latch e resta canonica, mentre il resto del loop vede
+  i valori traslati.
   */
-  PHINode* ivL1 = L1->getCanonicalInductionVariable();
-  PHINode* ivL2 = L2->getCanonicalInductionVariable();
+  auto *Inc = cast<BinaryOperator>(IV->getIncomingValueForBlock(L->getLoopLatch()));
 
-  if(!ivL1 || !ivL2)
-    return false;
-  
-  
-  ivL2->replaceAllUsesWith(ivL1);
-  ivL2->eraseFromParent();
+  IRBuilder<> Builder(&*L->getHeader()->getFirstInsertionPt());
+  auto *Shift = cast<BinaryOperator>(Builder.CreateAdd(IV, Offset, IV->getName() + ".shift"));
+  Shift->copyIRFlags(Inc);
+  IV->replaceUsesWithIf(Shift, [&](Use &U) { return U.getUser() != Shift; });
+
+  // Il vecchio incremento ora calcola IV + Offset + 1 per i suoi altri usi. 
+  Builder.SetInsertPoint(L->getLoopLatch()->getTerminator());
+  auto *NewInc = cast<BinaryOperator>(
+      Builder.CreateAdd(IV, ConstantInt::get(IV->getType(), 1), IV->getName() + ".next"));
+  NewInc->copyIRFlags(Inc);
+  IV->setIncomingValueForBlock(L->getLoopLatch(), NewInc);
+
+  RecursivelyDeleteTriviallyDeadInstructions(Inc);
+}
+
+PHINode *findInductionVariable(Loop *L, ScalarEvolution &SE){
+  /*
+  Restituisce la induction variable canonica del loop (parte da 0 con passo 1) oppure una
+  IV con passo 1 che parte da una costante C >= 0, ad esempio for (i = 1; i < n; i++),
+  che normalizeInductionVariable può rendere canonica. Non modifica l'IR.
+  */
+  if (PHINode *IV = L->getCanonicalInductionVariable())
+    return IV;
+
+  BasicBlock *PreHeader = L->getLoopPreheader();
+  BasicBlock *Latch = L->getLoopLatch();
+  for (PHINode &PN : L->getHeader()->phis()) {
+    if (!PN.getType()->isIntegerTy())
+      continue;
+
+    auto *AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(&PN));
+    auto *Start = dyn_cast<ConstantInt>(PN.getIncomingValueForBlock(PreHeader));
+    auto *Inc = dyn_cast<BinaryOperator>(PN.getIncomingValueForBlock(Latch));
+    if (!AR or AR->getLoop() != L or !AR->isAffine() or !AR->getStepRecurrence(SE)->isOne() or
+        !Start or Start->isNegative() or !Inc or Inc->getOpcode() != Instruction::Add)
+      continue;
+
+    return &PN;
+  }
+
+  return nullptr;
+}
+
+void normalizeInductionVariable(Loop *L, PHINode *IV, ScalarEvolution &SE){
+  /*
+  Rende canonica la IV restituita da findInductionVariable: se parte da una costante
+  C > 0 viene traslata, il phi parte da 0 e i suoi usi vedono IV + C.
+  */
+  BasicBlock *PreHeader = L->getLoopPreheader();
+  auto *Start = cast<ConstantInt>(IV->getIncomingValueForBlock(PreHeader));
+  if (Start->isZero())
+    return;
+
+  IV->setIncomingValueForBlock(PreHeader, ConstantInt::get(IV->getType(), 0));
+  shiftInductionVariable(L, IV, Start);
+  SE.forgetLoop(L);
+}
+
+void setExitCount(Loop *L, PHINode *IV, Value *ExitCount){
+  /*
+  Sostituisce la condizione di uscita dell'header con IV != ExitCount: con la IV canonica
+  il body del loop viene eseguito esattamente ExitCount volte.
+  */
+  BranchInst *HeaderBI = cast<BranchInst>(L->getHeader()->getTerminator());
+  Value *OldCond = HeaderBI->getCondition();
+
+  ICmpInst::Predicate Pred =
+      L->contains(HeaderBI->getSuccessor(0)) ? ICmpInst::ICMP_NE : ICmpInst::ICMP_EQ;
+  IRBuilder<> Builder(HeaderBI);
+  HeaderBI->setCondition(Builder.CreateICmp(Pred, IV, ExitCount, L->getHeader()->getName() + ".cond"));
+
+  RecursivelyDeleteTriviallyDeadInstructions(OldCond);
+}
+
+// Induction variable di L2 e la ricorrenza equivalente nelle iterazioni di L1. 
+using InductionRewrite = std::pair<PHINode *, const SCEV *>;
+
+void collectInductionRewrites(Loop *L1, Loop *L2, ScalarEvolution &SE, SCEVExpander &Expander,
+                              ArrayRef<BasicBlock *> Between,
+                              SmallVectorImpl<InductionRewrite> &Rewrites){
+  /*
+  Con lo stesso trip count l'iterazione k di L2 viene eseguita insieme all'iterazione k
+  di L1, quindi ogni induction variable {Start,+,Step}<L2> di L2 può essere riscritta
+  come {Start,+,Step}<L1> e calcolata nell'header di L1 con SCEVExpander, qualunque sia
+  la forma delle IV dei due loop (partenza da un offset, passo diverso da 1, conteggio
+  all'indietro). I phi che non sono ricorrenze affini (es. le riduzioni) non vengono
+  riscritti.
+  Il controllo avviene prima di modificare l'IR, quando il codice tra i due loop non è
+  ancora stato anticipato prima di L1: le espressioni vengono quindi controllate alla fine
+  del preheader di L2 e non devono usare i phi dei blocchi tra i loop, che non vengono
+  spostati.
+  */
+  Instruction *CheckPt = L2->getLoopPreheader()->getTerminator();
+  auto usesBetweenPHI = [&](const SCEV *S) {
+    auto *U = dyn_cast<SCEVUnknown>(S);
+    auto *PN = U ? dyn_cast<PHINode>(U->getValue()) : nullptr;
+    return PN and is_contained(Between, PN->getParent());
+  };
+
+  for (PHINode &PN : L2->getHeader()->phis()) {
+    if (!SE.isSCEVable(PN.getType()))
+      continue;
+
+    auto *AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(&PN));
+    if (!AR or AR->getLoop() != L2 or !AR->isAffine())
+      continue;
+
+    const SCEV *Start = AR->getStart();
+    const SCEV *Step = AR->getStepRecurrence(SE);
+    if (!SE.isLoopInvariant(Start, L1) or !SE.isLoopInvariant(Step, L1))
+      continue;
+
+    const SCEV *NewAR = SE.getAddRecExpr(Start, Step, L1, AR->getNoWrapFlags());
+    if (Expander.isSafeToExpandAt(NewAR, CheckPt) and !SCEVExprContains(NewAR, usesBetweenPHI))
+      Rewrites.push_back({&PN, NewAR});
+  }
+}
+
+bool canRemoveHeader(Loop *L1, Loop *L2, SmallVectorImpl<InductionRewrite> &Rewrites,
+                     SmallVectorImpl<Instruction *> &HeaderToMove){
+  /*
+  Con la fusione l'header di L2 viene eliminato, mentre il codice del latch resta in fondo
+  al body. I phi dell'header usati negli altri blocchi devono essere induction variable
+  riscrivibili (in Rewrites restano solo queste), mentre le altre istruzioni dell'header
+  usate negli altri blocchi vengono spostate nell'header di L1: devono essere senza side
+  effect e dipendere solo dai phi, da altre istruzioni spostate o da valori calcolati
+  prima di L1.
+  */
+  BasicBlock *Header = L2->getHeader();
+  SmallPtrSet<Instruction *, 8> Needed;
+
+  auto isUsedOutside = [&](Instruction &I) {
+    return any_of(I.users(), [&](User *U) {
+      auto *UserI = cast<Instruction>(U);
+      return UserI->getParent() != Header or Needed.count(UserI);
+    });
+  };
+
+  // Visito l'header al contrario, così gli usi vengono visti prima delle definizioni. 
+  for (Instruction &I : reverse(*Header)) {
+    if (isa<PHINode>(I) or I.isTerminator() or !isUsedOutside(I))
+      continue;
+    if (I.mayReadOrWriteMemory() or I.mayHaveSideEffects())
+      return false;
+
+    for (Value *Op : I.operands())
+      if (auto *OpI = dyn_cast<Instruction>(Op))
+        if (L1->contains(OpI) or (L2->contains(OpI) and OpI->getParent() != Header) or
+            (isa<PHINode>(OpI) and OpI->getParent() == L1->getExitBlock()))
+          return false;
+
+    Needed.insert(&I);
+  }
+
+  for (PHINode &PN : Header->phis())
+    if (isUsedOutside(PN) and none_of(Rewrites, [&](InductionRewrite &R) { return R.first == &PN; }))
+      return false;
+  erase_if(Rewrites, [&](InductionRewrite &R) { return !isUsedOutside(*R.first); });
+
+  for (Instruction &I : *Header)
+    if (Needed.count(&I))
+      HeaderToMove.push_back(&I);
 
   return true;
 }
 
-bool loopFuse(Loop *L1, Loop *L2, LoopInfo &LI){
+bool canFuseHeaderExitingLoops(Loop *L1, Loop *L2, ScalarEvolution &SE, SCEVExpander &Expander,
+                               ArrayRef<BasicBlock *> Between,
+                               SmallVectorImpl<InductionRewrite> &Rewrites,
+                               SmallVectorImpl<Instruction *> &HeaderToMove){
   /*
-  Funzione che fonde effettivamente i loop
+  Controlla, senza modificare l'IR, che due loop che escono dall'header possano essere
+  fusi: le IV di L2 usate nel body devono essere riscrivibili, l'header di L2 deve poter
+  essere eliminato e il body di L2 deve iniziare con un blocco raggiunto solo dall'header.
   */
-  if(!replaceUsesIV(L1, L2)){
-    outs() << "Errore nella modifica degli usi della Induction Varible nel Loop2.\n";
+  collectInductionRewrites(L1, L2, SE, Expander, Between, Rewrites);
+  if (!canRemoveHeader(L1, L2, Rewrites, HeaderToMove)) {
+    LLVM_DEBUG(dbgs() << "Header di L2 non eliminabile.\n");
     return false;
   }
-  
+
+  BasicBlock *L2Body = getBody(L2);
+  if (!L2Body or L2Body->getSinglePredecessor() != L2->getHeader()) {
+    LLVM_DEBUG(dbgs() << "Body di L2 non riconosciuto.\n");
+    return false;
+  }
+
+  return true;
+}
+
+void fuseHeaderExitingLoops(Loop *L1, Loop *L2, LoopInfo &LI, DomTreeUpdater &DTU,
+                            SCEVExpander &Expander, ArrayRef<InductionRewrite> Rewrites,
+                            ArrayRef<Instruction *> HeaderToMove,
+                            SmallVectorImpl<BasicBlock *> &Removed,
+                            SmallVectorImpl<DominatorTree::UpdateType> &Updates){
+  /*
+  Fusione di due loop che escono dall'header: l'header di L1 controlla l'uscita del loop
+  fuso, il body di L2 (anche con più blocchi) viene eseguito dopo il body di L1 e l'header
+  e il latch di L2 vengono eliminati. Rewrites e HeaderToMove sono quelli calcolati da
+  canFuseHeaderExitingLoops.
+  */
   // Recupero tutti i blocchi necessari
-  BasicBlock *L2PreHeader = getEntryBlock(L2);
+  BasicBlock *L2Body = getBody(L2);
+  BasicBlock *L1Exit = L1->getExitBlock();
 
   BasicBlock *L1Header = L1->getHeader();
   BasicBlock *L2Header = L2->getHeader();
 
-  BasicBlock *L2Body = getBody(L2);
-
   BasicBlock *L1Latch = L1->getLoopLatch();
   BasicBlock *L2Latch = L2->getLoopLatch();
 
   BasicBlock *L2Exit = L2->getExitBlock();
 
+  // Le induction variable di L2 vengono calcolate nell'header di L1, seguite dalle
+  // istruzioni dell'header di L2 che le usano. 
+  SmallVector<WeakTrackingVH, 4> OldIncrements;
+  for (auto [PN, NewAR] : Rewrites) {
+    OldIncrements.push_back(PN->getIncomingValueForBlock(L2Latch));
+    PN->replaceAllUsesWith(Expander.expandCodeFor(NewAR, PN->getType(), L1Header->getTerminator()));
+    PN->eraseFromParent();
+  }
+  for (Instruction *I : HeaderToMove)
+    I->moveBefore(L1Header->getTerminator());
+  RecursivelyDeleteTriviallyDeadInstructionsPermissive(OldIncrements);
+
+  // Il codice del latch di L2 resta in fondo al suo body: il latch eliminato contiene
+  // solo il salto all'header. 
+  if (L2Latch->getTerminator() != &L2Latch->front())
+    L2Latch = SplitBlock(L2Latch, L2Latch->getTerminator(), &DTU, &LI);
+
+  // Il body di L1 deve arrivare al latch da un solo blocco. Se il latch contiene phi o
+  // accessi in memoria il suo codice resta in fondo al body di L1, prima del body di L2. 
+  if (!L1Latch->getSinglePredecessor() or any_of(*L1Latch, [](Instruction &I) {
+        return isa<PHINode>(I) or I.mayReadOrWriteMemory() or I.mayHaveSideEffects();
+      }))
+    L1Latch = SplitBlock(L1Latch, L1Latch->getTerminator(), &DTU, &LI);
+  BasicBlock *L1BodyEnd = L1Latch->getSinglePredecessor();
+
+  // I phi LCSSA di L1 passano all'exit block di L2, che dopo la fusione avrà L1Header
+  // come unico predecessore. 
+  for (PHINode &PN : make_early_inc_range(L1Exit->phis()))
+    PN.moveBefore(&L2Exit->front());
+
   // Change 
   //  L1Header 
   //    -> (True) L1Body 
-  //    -> (False) L2Preheader
+  //    -> (False) L1Exit -> ... -> L2Preheader
   // To  
   //  L1Header 
   //    -> (True) L1Body 
   //    -> (False) L2Exit
-  L1Header->getTerminator()->replaceSuccessorWith(L2PreHeader, L2Exit);
-
-  // Tutti i predecessori del Latch di L1 (i blocchi che formavano il body di L1)
-  // dovranno avere un link verso al body di L2. Così facendo il body di L2 verrà eseguito
-  // dopo il body di L1
-  for(auto *L1LatchPred : predecessors(L1Latch))
-    L1LatchPred->getTerminator()->replaceSuccessorWith(L1Latch, L2Body);
+  L1Header->getTerminator()->replaceSuccessorWith(L1Exit, L2Exit);
+  L2Exit->replacePhiUsesWith(L2Header, L1Header);
+  Updates.push_back({DominatorTree::Delete, L1Header, L1Exit});
+  Updates.push_back({DominatorTree::Insert, L1Header, L2Exit});
 
+  // L'ultimo blocco del body di L1 dovrà avere un link verso il body di L2. Così facendo
+  // il body di L2 verrà eseguito dopo il body di L1
+  L1BodyEnd->getTerminator()->replaceSuccessorWith(L1Latch, L2Body);
+  L2Body->replacePhiUsesWith(L2Header, L1BodyEnd);
+  Updates.push_back({DominatorTree::Delete, L1BodyEnd, L1Latch});
+  Updates.push_back({DominatorTree::Insert, L1BodyEnd, L2Body});
 
   // Tutti i predecessori del Latch di L2 (i blocchi che formavano il body di L2)
   // dovranno avere un link verso il latch di L1. Così facendo, una volta terminato il body di L2
   // verrà eseguito il Latch di L1. 
-  for(auto *L2LatchPred : predecessors(L2Latch))
+  SmallSetVector<BasicBlock *, 4> L2LatchPreds(pred_begin(L2Latch), pred_end(L2Latch));
+  for (BasicBlock *L2LatchPred : L2LatchPreds) {
     L2LatchPred->getTerminator()->replaceSuccessorWith(L2Latch, L1Latch);
+    Updates.push_back({DominatorTree::Delete, L2LatchPred, L2Latch});
+    Updates.push_back({DominatorTree::Insert, L2LatchPred, L1Latch});
+  }
+
+  // L'header e il latch di L2 non sono più raggiungibili. 
+  Removed.push_back(L2Header);
+  Removed.push_back(L2Latch);
+}
+
+void fuseRotatedLoops(Loop *L1, Loop *L2, SmallVectorImpl<DominatorTree::UpdateType> &Updates){
+  /*
+  Fusione di due loop ruotati, che escono dal latch: il latch di L2 controlla l'uscita del
+  loop fuso. Alla fine del body di L1 si salta all'header di L2, i cui phi passano
+  nell'header di L1, e il latch di L2 torna all'header di L1.
+  Se i loop hanno la guardia resta solo quella di L1, che salta direttamente dopo L2.
+  */
+  BasicBlock *L1PreHeader = L1->getLoopPreheader();
+  BasicBlock *L1Header = L1->getHeader();
+  BasicBlock *L1Latch = L1->getLoopLatch();
+  BasicBlock *L1Exit = L1->getExitBlock();
+
+  BasicBlock *L2PreHeader = L2->getLoopPreheader();
+  BasicBlock *L2Header = L2->getHeader();
+  BasicBlock *L2Latch = L2->getLoopLatch();
+  BasicBlock *L2Exit = L2->getExitBlock();
+
+  // Le guardie vanno cercate prima di modificare il CFG. 
+  BranchInst *Guard1 = L1->getLoopGuardBranch();
+  BranchInst *Guard2 = L2->getLoopGuardBranch();
+  BasicBlock *Skip1 = Guard1 ? getGuardSkipBlock(L1) : nullptr;
+  BasicBlock *Skip2 = Guard2 ? getGuardSkipBlock(L2) : nullptr;
+
+  // I phi LCSSA di L1 passano all'exit block di L2. 
+  for (PHINode &PN : make_early_inc_range(L1Exit->phis())) {
+    PN.replaceIncomingBlockWith(L1Latch, L2Latch);
+    PN.moveBefore(&L2Exit->front());
+  }
+
+  // I phi di L2 ricevono il valore iniziale dal preheader di L1 e quello successivo dal
+  // latch di L2, che diventa il latch del loop fuso. 
+  L1Header->replacePhiUsesWith(L1Latch, L2Latch);
+  for (PHINode &PN : make_early_inc_range(L2Header->phis())) {
+    PN.replaceIncomingBlockWith(L2PreHeader, L1PreHeader);
+    PN.moveBefore(L1Header->getFirstNonPHI());
+  }
 
   // Change 
-  //  L2Header 
-  //    -> L2Body 
+  //  L1Latch -> (True) L1Header, (False) L1Exit 
+  //  L2Latch -> (True) L2Header, (False) L2Exit 
   // To  
-  //  L2Header 
-  //    -> L2Latch
-  L2Header->getTerminator()->replaceSuccessorWith(L2Body, L2Latch);
+  //  L1Latch -> L2Header 
+  //  L2Latch -> (True) L1Header, (False) L2Exit 
+  BranchInst *L1LatchBI = cast<BranchInst>(L1Latch->getTerminator());
+  Value *L1Cond = L1LatchBI->getCondition();
+  BranchInst::Create(L2Header, L1LatchBI);
+  L1LatchBI->eraseFromParent();
+  RecursivelyDeleteTriviallyDeadInstructions(L1Cond);
+  L2Latch->getTerminator()->replaceSuccessorWith(L2Header, L1Header);
+  Updates.push_back({DominatorTree::Delete, L1Latch, L1Header});
+  Updates.push_back({DominatorTree::Delete, L1Latch, L1Exit});
+  Updates.push_back({DominatorTree::Insert, L1Latch, L2Header});
+  Updates.push_back({DominatorTree::Delete, L2Latch, L2Header});
+  Updates.push_back({DominatorTree::Insert, L2Latch, L1Header});
 
+  if (!Guard1)
+    return;
+
+  // Change 
+  //  Guard1 -> (True) L1, (False) Skip1 -> ... -> Guard2 -> (True) L2, (False) Skip2 
+  // To  
+  //  Guard1 -> (True) L1 + L2, (False) Skip2 
+  // I phi di Skip1 (i risultati di L1 oppure i valori con i loop saltati) passano in Skip2. 
+  BasicBlock *Guard1BB = Guard1->getParent();
+  BasicBlock *Guard2BB = Guard2->getParent();
+  BasicBlock *Skip1Pred = *find_if(predecessors(Skip1), [&](BasicBlock *BB) { return BB != Guard1BB; });
+  BasicBlock *Skip2Pred = *find_if(predecessors(Skip2), [&](BasicBlock *BB) { return BB != Guard2BB; });
+
+  Skip2->replacePhiUsesWith(Guard2BB, Guard1BB);
+  for (PHINode &PN : make_early_inc_range(Skip1->phis())) {
+    PN.replaceIncomingBlockWith(Skip1Pred, Skip2Pred);
+    PN.moveBefore(&Skip2->front());
+  }
+  Guard1->replaceSuccessorWith(Skip1, Skip2);
+  Updates.push_back({DominatorTree::Delete, Guard1BB, Skip1});
+  Updates.push_back({DominatorTree::Insert, Guard1BB, Skip2});
+}
+
+bool loopFuse(Loop *L1, Loop *L2, LoopInfo &LI, DomTreeUpdater &DTU, ScalarEvolution &SE){
+  /*
+  Funzione che fonde effettivamente i loop. Ogni arco del CFG aggiunto o tolto viene
+  comunicato al DomTreeUpdater, così dominator e post-dominator tree vengono aggiornati
+  in modo incrementale invece di essere ricalcolati dopo ogni fusione.
+  */
+  SmallVector<BasicBlock *, 4> Between;
+  if (!getBlocksBetween(L1, L2, Between)) {
+    LLVM_DEBUG(dbgs() << "Blocchi tra i loop non eliminabili.\n");
+    return false;
+  }
+
+  // Tutti i controlli che possono fallire vengono eseguiti prima di modificare l'IR. 
+  bool Rotated = exitsFromLatch(L1);
+  SCEVExpander Expander(SE, L1->getHeader()->getModule()->getDataLayout(), "fuse");
+  SmallVector<InductionRewrite, 4> Rewrites;
+  SmallVector<Instruction *, 4> HeaderToMove;
+  if (!Rotated and !canFuseHeaderExitingLoops(L1, L2, SE, Expander, Between, Rewrites, HeaderToMove))
+    return false;
+
+  // Il codice tra i due loop (a parte i phi) viene anticipato in fondo al preheader di L1,
+  // così anche le IV di L2 che lo usano possono essere calcolate in L1. Con la guardia
+  // viene anticipato prima della guardia di L1, perché viene eseguito anche se i loop
+  // vengono saltati. 
+  Instruction *HoistPt = L1->getLoopGuardBranch();
+  if (!HoistPt)
+    HoistPt = L1->getLoopPreheader()->getTerminator();
+  for (BasicBlock *BB : Between)
+    for (Instruction &I : make_early_inc_range(*BB))
+      if (!isa<PHINode>(I) and !I.isTerminator())
+        I.moveBefore(HoistPt);
+
+  SmallVector<BasicBlock *, 8> Removed(Between.begin(), Between.end());
+  SmallVector<DominatorTree::UpdateType, 16> Updates;
+  if (Rotated)
+    fuseRotatedLoops(L1, L2, Updates);
+  else
+    fuseHeaderExitingLoops(L1, L2, LI, DTU, Expander, Rewrites, HeaderToMove, Removed, Updates);
 
   // Questa parte serve per aggiornare la composizione dei blocchi del Loop appena fuso, 
   // in pratica si dice quali blocchi fanno parte del nuovo loop e quali no. 
-  // I blocchi del body del Loop2 verranno aggiunti al nuovo Loop ottenuto dalla fusione, 
-  // questi blocchi corrisponderanno a tutti i blocchi TRANNE l'header e il latch. 
-  for(auto blocksL2 : L2->blocks()){
-    if(blocksL2 != L2Header && blocksL2 != L2Latch){
-      L1->addBasicBlockToLoop(blocksL2, LI);
-    }
+  // I blocchi tra i due loop (e l'header e il latch di L2 se sono stati eliminati) non
+  // sono più raggiungibili e vengono tolti dal LoopInfo prima di essere eliminati. 
+  // Terminano con unreachable, così non sono più predecessori dei blocchi rimasti. 
+  for (BasicBlock *BB : Removed) {
+    for (BasicBlock *Succ : successors(BB))
+      Updates.push_back({DominatorTree::Delete, BB, Succ});
+    BB->getTerminator()->eraseFromParent();
+    new UnreachableInst(BB->getContext(), BB);
+    LI.removeBlock(BB);
+  }
+
+  // Lo stesso arco può comparire più volte (es. più predecessori del latch di L2 con lo
+  // stesso successore): applyUpdatesPermissive scarta i duplicati. 
+  DTU.applyUpdatesPermissive(Updates);
+
+  // Tutti gli altri blocchi di L2, compresi quelli dei suoi sottoloop, vengono aggiunti
+  // al loop fuso e i sottoloop di L2 diventano sottoloop di L1. L2 resta vuoto e potrà
+  // essere eliminato dal LoopInfo. 
+  SmallVector<BasicBlock *, 8> BlocksL2(L2->blocks());
+  for (BasicBlock *BB : BlocksL2) {
+    L1->addBlockEntry(BB);
+    L2->removeBlockFromLoop(BB);
+    if (LI.getLoopFor(BB) == L2)
+      LI.changeLoopFor(BB, L1);
   }
+
+  while (!L2->isInnermost())
+    L1->addChildLoop(L2->removeChildLoop(L2->begin()));
+
+  DeleteDeadBlocks(Removed, &DTU);
   return true;
 
 }
 
-std::list<Loop *> getTopLevelLoops(LoopInfo &LI, bool verbose = false){
+bool canMergeLoops(Loop *L1, Loop *L2, ScalarEvolution &SE, bool PeelLast){
+  /*
+  Controlla, senza modificare l'IR, che loopFuse possa unire i due loop. Serve prima del
+  peeling, che modifica l'IR e va eseguito solo se la fusione andrà a buon fine.
+  Se verranno tolte le ultime iterazioni di L2, la copia posta dopo L2 riparte dai valori
+  di tutti i phi dell'header di L2: dopo la fusione devono poter essere calcolati in L1,
+  quindi devono essere tutti induction variable riscrivibili.
+  */
+  SmallVector<BasicBlock *, 4> Between;
+  if (!getBlocksBetween(L1, L2, Between))
+    return false;
+  if (exitsFromLatch(L1))
+    return true;
+
+  SCEVExpander Expander(SE, L1->getHeader()->getModule()->getDataLayout(), "fuse");
+  SmallVector<InductionRewrite, 4> Rewrites;
+  SmallVector<Instruction *, 4> HeaderToMove;
+  if (PeelLast) {
+    collectInductionRewrites(L1, L2, SE, Expander, Between, Rewrites);
+    for (PHINode &PN : L2->getHeader()->phis())
+      if (none_of(Rewrites, [&](InductionRewrite &R) { return R.first == &PN; }))
+        return false;
+    Rewrites.clear();
+  }
+  return canFuseHeaderExitingLoops(L1, L2, SE, Expander, Between, Rewrites, HeaderToMove);
+}
+
+PHINode *createExitPHI(PHINode &PN, BasicBlock *Exit){
+  /*
+  Crea nell'exit block di un loop che esce dall'header il phi LCSSA con il valore che PN
+  ha all'uscita del loop.
+  */
+  PHINode *ExitPN = PHINode::Create(PN.getType(), 1, PN.getName() + ".lcssa", &Exit->front());
+  ExitPN->addIncoming(&PN, PN.getParent());
+  return ExitPN;
+}
+
+Loop *clonePeeledLoop(Loop *L, BasicBlock *Before, BasicBlock *LoopDomBB, ValueToValueMapTy &VMap,
+                      LoopInfo &LI, DominatorTree &DT){
+  /*
+  Crea una copia del loop (con il suo preheader) che eseguirà le iterazioni tolte a L.
+  */
+  SmallVector<BasicBlock *, 8> Blocks;
+  Loop *Peeled = cloneLoopWithPreheader(Before, LoopDomBB, L, VMap, ".peel", &LI, &DT, Blocks);
+  remapInstructionsInBlocks(Blocks, VMap);
+  return Peeled;
+}
+
+void peelFirstIterations(Loop *L, PHINode *IV, unsigned Count, LoopInfo &LI, DominatorTree &DT){
+  /*
+  Le prime Count iterazioni di L vengono eseguite da una copia del loop posta prima di L.
+  L riparte dall'iterazione Count: i phi dell'header partono dai valori con cui esce la
+  copia (tramite i phi LCSSA della copia nel nuovo preheader) e la IV viene traslata di Count.
+  */
+  BasicBlock *OldPreHeader = L->getLoopPreheader();
+  BasicBlock *PreHeader = SplitBlock(OldPreHeader, OldPreHeader->getTerminator(), &DT, &LI);
+  BasicBlock *Exit = L->getExitBlock();
+
+  ValueToValueMapTy VMap;
+  Loop *Peeled = clonePeeledLoop(L, PreHeader, OldPreHeader, VMap, LI, DT);
+  BasicBlock *PeeledHeader = Peeled->getHeader();
+
+  // OldPreHeader -> copia -> PreHeader -> L
+  OldPreHeader->getTerminator()->replaceSuccessorWith(PreHeader, Peeled->getLoopPreheader());
+  PeeledHeader->getTerminator()->replaceSuccessorWith(Exit, PreHeader);
+  DT.changeImmediateDominator(PreHeader, PeeledHeader);
+
+  setExitCount(Peeled, cast<PHINode>(VMap[IV]), ConstantInt::get(IV->getType(), Count));
+
+  for (PHINode &PN : L->getHeader()->phis())
+    if (&PN != IV)
+      PN.setIncomingValueForBlock(PreHeader, createExitPHI(*cast<PHINode>(VMap[&PN]), PreHeader));
+  shiftInductionVariable(L, IV, ConstantInt::get(IV->getType(), Count));
+}
+
+void peelLastIterations(Loop *L, PHINode *IV, Value *ExitCount, LoopInfo &LI, DominatorTree &DT){
+  /*
+  L esegue solo le prime ExitCount iterazioni, le rimanenti vengono eseguite da una copia
+  del loop posta dopo L, i cui phi dell'header partono dai valori con cui esce L (tramite
+  i phi LCSSA di L nel preheader della copia, che è il nuovo exit block di L).
+  */
+  // Il preheader copiato deve essere vuoto. 
+  BasicBlock *OldPreHeader = L->getLoopPreheader();
+  SplitBlock(OldPreHeader, OldPreHeader->getTerminator(), &DT, &LI);
+  BasicBlock *Header = L->getHeader();
+  BasicBlock *Exit = L->getExitBlock();
+
+  ValueToValueMapTy VMap;
+  Loop *Peeled = clonePeeledLoop(L, Exit, Header, VMap, LI, DT);
+  BasicBlock *PeeledPreHeader = Peeled->getLoopPreheader();
+  BasicBlock *PeeledHeader = Peeled->getHeader();
+
+  // L -> copia -> Exit
+  Header->getTerminator()->replaceSuccessorWith(Exit, PeeledPreHeader);
+  Exit->replacePhiUsesWith(Header, PeeledHeader);
+  DT.changeImmediateDominator(Exit, PeeledHeader);
+
+  // Dopo il loop vengono usati i valori con cui esce la copia. 
+  for (BasicBlock *BB : L->blocks())
+    for (Instruction &I : *BB)
+      for (Use &U : make_early_inc_range(I.uses())) {
+        auto *UserI = cast<Instruction>(U.getUser());
+        if (!L->contains(UserI) and !Peeled->contains(UserI))
+          U.set(VMap[&I]);
+      }
+
+  for (PHINode &PN : Header->phis())
+    cast<PHINode>(VMap[&PN])->setIncomingValueForBlock(PeeledPreHeader, createExitPHI(PN, PeeledPreHeader));
+
+  setExitCount(L, IV, ExitCount);
+}
+
+bool getPeelCount(Loop *L1, Loop *L2, ScalarEvolution &SE, unsigned &Count, bool &PeelFirst){
+  /*
+  Controlla, senza modificare l'IR, se i trip count di due loop che differiscono per un
+  numero piccolo e costante di iterazioni (es. i < n e i < n - 1) possono essere allineati
+  togliendo Count iterazioni al loop più lungo:
+  - se è L1 (PeelFirst) le prime iterazioni vengono eseguite da una copia posta prima di
+    L1, così L1 resta adiacente a L2;
+  - se è L2 le ultime iterazioni vengono eseguite da una copia posta dopo L2.
+  */
+  const SCEV *ExitCount1 = SE.getExitCount(L1, L1->getExitingBlock());
+  const SCEV *ExitCount2 = SE.getExitCount(L2, L2->getExitingBlock());
+  if (isa<SCEVCouldNotCompute>(ExitCount1) or isa<SCEVCouldNotCompute>(ExitCount2) or
+      ExitCount1->getType() != ExitCount2->getType())
+    return false;
+
+  auto *Diff = dyn_cast<SCEVConstant>(SE.getMinusSCEV(ExitCount1, ExitCount2));
+  if (!Diff or Diff->isZero() or Diff->getAPInt().abs().ugt(MaxPeelCount))
+    return false;
+
+  PeelFirst = Diff->getAPInt().isStrictlyPositive();
+  Loop *Long = PeelFirst ? L1 : L2;
+  const SCEV *LongExitCount = PeelFirst ? ExitCount1 : ExitCount2;
+  const SCEV *ShortExitCount = PeelFirst ? ExitCount2 : ExitCount1;
+  Count = Diff->getAPInt().abs().getZExtValue();
+
+  // Il loop più lungo deve uscire dall'header ed eseguire almeno Count iterazioni, e la
+  // sua nuova condizione di uscita deve poter essere calcolata nel preheader. 
+  Instruction *InsertPt = Long->getLoopPreheader()->getTerminator();
+  SCEVExpander Expander(SE, L1->getHeader()->getModule()->getDataLayout(), "peel");
+  if (Long->getExitingBlock() != Long->getHeader() or !getBody(Long) or
+      !SE.isKnownPredicate(ICmpInst::ICMP_UGE, LongExitCount,
+                           SE.getConstant(LongExitCount->getType(), Count)) or
+      !Expander.isSafeToExpandAt(ShortExitCount, InsertPt))
+    return false;
+
+  PHINode *IV = findInductionVariable(Long, SE);
+  return IV and IV->getType() == ShortExitCount->getType();
+}
+
+void alignTripCounts(Loop *L1, Loop *L2, unsigned Count, bool PeelFirst, LoopInfo &LI,
+                     DomTreeUpdater &DTU, ScalarEvolution &SE, OptimizationRemarkEmitter &ORE){
+  /*
+  Esegue il peeling calcolato da getPeelCount. I trip count differiscono esattamente di
+  Count e il loop più lungo viene fatto uscire dopo ExitCount iterazioni del più corto,
+  quindi dopo il peeling i due loop hanno lo stesso trip count.
+  */
+  Loop *Long = PeelFirst ? L1 : L2;
+  Loop *Short = PeelFirst ? L2 : L1;
+  const SCEV *ShortExitCount = SE.getExitCount(Short, Short->getExitingBlock());
+  Instruction *InsertPt = Long->getLoopPreheader()->getTerminator();
+  SCEVExpander Expander(SE, L1->getHeader()->getModule()->getDataLayout(), "peel");
+
+  PHINode *IV = findInductionVariable(Long, SE);
+  normalizeInductionVariable(Long, IV, SE);
+
+  // La copia del loop viene aggiunta direttamente al dominator tree, mentre il
+  // post-dominator tree viene ricalcolato: il peeling avviene al massimo una volta per
+  // coppia di loop. 
+  DominatorTree &DT = DTU.getDomTree();
+  PostDominatorTree &PDT = DTU.getPostDomTree();
+  Value *ExitCount = Expander.expandCodeFor(ShortExitCount, IV->getType(), InsertPt);
+  if (PeelFirst) {
+    peelFirstIterations(L1, IV, Count, LI, DT);
+    setExitCount(L1, IV, ExitCount);
+  } else
+    peelLastIterations(L2, IV, ExitCount, LI, DT);
+  PDT.recalculate(*L1->getHeader()->getParent());
+
+  NumPeeled++;
+  ORE.emit([&]() {
+    return OptimizationRemark(DEBUG_TYPE, "Peeled", Long->getStartLoc(), Long->getHeader())
+           << "peeled " << ore::NV("PeelCount", Count) << (PeelFirst ? " first" : " last")
+           << " iterations of loop in " << ore::NV("Header", Long->getHeader()->getName())
+           << " to align its trip count";
+  });
+
+  SE.forgetLoop(L1);
+  SE.forgetLoop(L2);
+  assert(isSameTripCount(L1, L2, SE) && "Peeling did not align the trip counts");
+}
+
+std::list<Loop *> getSiblingLoops(ArrayRef<Loop *> Loops){
   /*
-  Funzione che crea e restituisce una lista dei TopLevelLoops presenti nel programma, 
-  solo dopo avere controllato che fossero Ok For Fusion. 
+  Funzione che crea e restituisce una lista dei loop fratelli (i top level loops oppure
+  i sottoloop di uno stesso loop), solo dopo avere controllato che fossero Ok For Fusion. 
   */
-  std::list<Loop *> topLevelLoops;
+  std::list<Loop *> siblingLoops;
 
-  for (auto *TopLevelLoop : LI){
-    if (isOkForFusion(TopLevelLoop))
-      topLevelLoops.push_front(TopLevelLoop);
+  for (auto *SiblingLoop : Loops){
+    if (isOkForFusion(SiblingLoop))
+      siblingLoops.push_front(SiblingLoop);
   }
 
-  if(verbose)
-    for(auto L : topLevelLoops)
-      L->print(outs());
-    
-  return topLevelLoops;
+  LLVM_DEBUG(for (auto L : siblingLoops) L->print(dbgs()));
+
+  return siblingLoops;
 }
 
-bool tryLoopFusion(std::list<Loop *> topLevelLoops, LoopInfo &LI, DominatorTree &DT, PostDominatorTree &PDT, ScalarEvolution &SE, DependenceInfo &DI){
-  // Funzione che "prova" a fare una loop fusion provando tutte le coppie possibili
-  // di loop presenti nel programma. 
+void missedFusion(Loop *L1, Loop *L2, StringRef RemarkName, StringRef Reason,
+                  OptimizationRemarkEmitter &ORE) {
+  /*
+  Funzione che emette il remark con il motivo per cui la coppia non viene fusa.
+  */
+  ORE.emit([&]() {
+    return OptimizationRemarkMissed(DEBUG_TYPE, RemarkName, L1->getStartLoc(),
+                                    L1->getHeader())
+           << "loop in " << ore::NV("Header", L1->getHeader()->getName())
+           << " not fused with loop in "
+           << ore::NV("OtherHeader", L2->getHeader()->getName()) << ": "
+           << Reason;
+  });
+}
 
-  // Se la funzione termina restituendo falso allora l'analisi è completata, non ci sono loop da fondere. 
-  // Se la funzione restitusice true vuol dire che c'è stata una fusione e quindi questa funzione verrà richiamata. 
-  
-  bool areFusable = true;
+// Insieme di loop control flow equivalent, ordinati secondo la dominanza (cioè
+// nell'ordine in cui vengono eseguiti): solo loop consecutivi possono essere adiacenti. 
+using FusionCandidateSet = std::list<Loop *>;
+using FusionCandidateCollection = SmallVector<FusionCandidateSet, 4>;
 
-  for (auto it1 = topLevelLoops.begin(); it1 != topLevelLoops.end(); ++it1) {
-    for (auto it2 = std::next(it1); it2 != topLevelLoops.end(); ++it2) {
-      // Scorro la lista dei toop level loops con due iteratori. 
-  
-      areFusable = true;
+FusionCandidateCollection collectFusionCandidates(ArrayRef<Loop *> Siblings, DominatorTree &DT,
+                                                  PostDominatorTree &PDT,
+                                                  OptimizationRemarkEmitter &ORE) {
+  /*
+  Funzione che raggruppa dei loop fratelli in insiemi di loop control flow equivalent
+  (come i FusionCandidateSet di LLVM). Ogni loop viene confrontato solo con il primo
+  loop di ogni insieme, invece che con tutti gli altri loop. 
+  */
+  FusionCandidateCollection Candidates;
+
+  for (Loop *L : getSiblingLoops(Siblings)) {
+    bool Inserted = false;
+
+    for (FusionCandidateSet &Set : Candidates) {
+      Loop *Representative = Set.front();
+      if (areControlFlowEquivalent(getEntryBlock(Representative), getEntryBlock(L), DT, PDT) or
+          areControlFlowEquivalent(getEntryBlock(L), getEntryBlock(Representative), DT, PDT)) {
+        Set.push_back(L);
+        Inserted = true;
+        break;
+      }
+      NumNotCFE++;
+      missedFusion(Representative, L, "NotControlFlowEquivalent", "not control flow equivalent", ORE);
+    }
 
-      Loop *L1 = *it1;
-      Loop *L2 = *it2;
+    if (!Inserted)
+      Candidates.push_back({L});
+  }
+
+  // I loop di un insieme sono totalmente ordinati dalla dominanza dei loro entry block. 
+  for (FusionCandidateSet &Set : Candidates)
+    Set.sort([&](Loop *L1, Loop *L2) {
+      return L1 != L2 and DT.dominates(getEntryBlock(L1), getEntryBlock(L2));
+    });
+
+  return Candidates;
+}
 
-      outs() << "\nL1 => ";
-      L1->print(outs());
+bool fuseCandidateSet(FusionCandidateSet &Set, LoopInfo &LI, DomTreeUpdater &DTU, ScalarEvolution &SE,
+                      DependenceInfo &DI, const TargetTransformInfo &TTI, OptimizationRemarkEmitter &ORE){
+  /*
+  Funzione che scorre una sola volta l'insieme di loop control flow equivalent provando
+  a fondere ogni loop con il successivo. Dopo una fusione il loop ottenuto resta in testa
+  alla catena e viene confrontato con il loop seguente, così una catena di k loop viene
+  fusa con k - 1 controlli invece di ricominciare da capo dopo ogni fusione. 
+  */
+  bool Changed = false;
+  auto it1 = Set.begin();
 
-      outs() << "L2 => ";
-      L2->print(outs());
+  while (it1 != Set.end() and std::next(it1) != Set.end()) {
+    auto it2 = std::next(it1);
+    Loop *L1 = *it1;
+    Loop *L2 = *it2;
 
-      // Eseguo tutti i controlli
-      bool cfeCheck = areControlFlowEquivalent(getEntryBlock(L1), getEntryBlock(L2), DT, PDT);
-      outs() << (cfeCheck ? "Sono CFE\n" : "Non sono CFE\n");
+    // ScalarEvolution, DependenceInfo e SCEVExpander usano direttamente il dominator tree:
+    // gli aggiornamenti della fusione precedente vanno applicati prima di ogni controllo.
+    DTU.flush();
 
-      bool adjCheck = areAdjacent(L1, L2);
-      outs() << (adjCheck ? "Sono adiacenti\n" : "Non sono adiacenti\n");
+    // Eseguo tutti i controlli, fermandomi al primo che fallisce:
+    // tutti i controlli devono essere verificati affinchè possa avvenire la loop fuse. 
+    // Se un controllo fallisce L2 diventa la nuova testa della catena. 
+    if (!areAdjacent(L1, L2)) {
+      NumNotAdjacent++;
+      missedFusion(L1, L2, "NotAdjacent", "not adjacent", ORE);
+      it1 = it2;
+      continue;
+    }
 
-      bool tcCheck = isSameTripCount(L1, L2, SE);
-      outs() << (tcCheck ? "Hanno lo stesso trip count\n" : "Non hanno lo stesso trip count\n");
+    if (!haveCompatibleControlFlow(L1, L2, SE)) {
+      NumIncompatibleControlFlow++;
+      missedFusion(L1, L2, "IncompatibleControlFlow",
+                   "loops exit from different blocks or have non-equivalent guards", ORE);
+      it1 = it2;
+      continue;
+    }
 
-      bool negdisCheck = haveNegativeDistance(L1, L2, DI);
-      outs() << (!negdisCheck ? "Non ci sono dipendenze\n" : "");
+    // Trip count che differiscono di poche iterazioni vengono allineati con il peeling,
+    // che però modifica l'IR: viene eseguito solo dopo tutti gli altri controlli. 
+    unsigned PeelCount = 0;
+    bool PeelFirst = false;
+    if (!isSameTripCount(L1, L2, SE) and !getPeelCount(L1, L2, SE, PeelCount, PeelFirst)) {
+      NumTripCountMismatch++;
+      missedFusion(L1, L2, "TripCountMismatch", "trip count mismatch", ORE);
+      it1 = it2;
+      continue;
+    }
 
-      // Tutti i controlli devono essere verificati affinchè possa avvenire la loop fuse. 
-      areFusable = cfeCheck && adjCheck && tcCheck && !negdisCheck;
+    // Due nest vengono fusi a partire dal loop più esterno: i loop interni diventano
+    // fratelli all'interno del loop fuso e vengono fusi al livello successivo. 
+    SmallVector<Loop *, 4> Nest1, Nest2;
+    if (!areConformantNests(L1, L2, SE, Nest1, Nest2)) {
+      NumNotConformantNest++;
+      missedFusion(L1, L2, "NotConformantNests",
+                   "loop nests are not perfectly nested with matching depth and trip counts", ORE);
+      it1 = it2;
+      continue;
+    }
 
-      if(areFusable){
-        if(loopFuse(L1, L2, LI)){ // Fondo i loop
-          outs() << "Loop fusi correttamente.\n\n";
-          LI.erase(L2); // Rimuovo dal loop info L2 in modo tale che non esista più. 
-          return true;
+    if (usesValuesFromLoop(L2, L1)) {
+      NumScalarDependence++;
+      missedFusion(L1, L2, "ScalarDependence",
+                   "second loop uses values computed in the first loop", ORE);
+      it1 = it2;
+      continue;
+    }
 
-        }
-        else
-          outs() << "Errore durante loop fusion.\n\n";
+    if (haveNegativeDistance(Nest1, Nest2, PeelFirst ? PeelCount : 0, DI, SE)) {
+      NumNegativeDistance++;
+      missedFusion(L1, L2, "NegativeDistance", "negative dependence distance", ORE);
+      it1 = it2;
+      continue;
+    }
+
+    if (PeelCount) {
+      if (!canMergeLoops(L1, L2, SE, !PeelFirst)) {
+        NumFusionFailed++;
+        missedFusion(L1, L2, "FusionFailed", "loop control could not be merged", ORE);
+        it1 = it2;
+        continue;
       }
-      outs() << "\n\n";
+
+      alignTripCounts(L1, L2, PeelCount, PeelFirst, LI, DTU, SE, ORE);
+      Changed = true;
+    }
+
+    // Le dipendenze vengono analizzate finché i due loop sono separati: se nel loop fuso
+    // gli accessi sono indipendenti tra iterazioni diverse lo indico con i metadati.
+    // Il loop ID di L1 viene salvato perché il latch del loop fuso può cambiare. La
+    // vettorizzazione viene forzata solo se i loop non hanno altre ricorrenze scalari.
+    bool Parallel = EmitParallelMetadata and areFusedAccessesParallel(L1, L2, DI, SE);
+    MDNode *OrigLoopID = L1->getLoopID();
+    bool AddVectorizeHints = hasVectorizeTransformation(L1) == TM_Unspecified and
+                             hasOnlyInductionPhis(L1, SE) and hasOnlyInductionPhis(L2, SE);
+
+    // Le espressioni SCEV dei due loop non sono più valide dopo la fusione: gli
+    // accessi del loop fuso devono essere rianalizzati nei controlli successivi. 
+    SE.forgetLoop(L1);
+    SE.forgetLoop(L2);
+
+    // Dopo la fusione L2 non ha più blocchi: salvo il suo header per il remark. 
+    BasicBlock *L2Header = L2->getHeader();
+    if (!loopFuse(L1, L2, LI, DTU, SE)) {
+      NumFusionFailed++;
+      missedFusion(L1, L2, "FusionFailed", "loop control could not be merged", ORE);
+      it1 = it2;
+      continue;
     }
+
+    // Il loop fuso contiene anche i blocchi di L2. 
+    SE.forgetLoop(L1);
+    NumFused++;
+    ORE.emit([&]() {
+      return OptimizationRemark(DEBUG_TYPE, "Fused", L1->getStartLoc(),
+                                L1->getHeader())
+             << "loop in " << ore::NV("Header", L1->getHeader()->getName())
+             << " fused with loop in "
+             << ore::NV("OtherHeader", L2Header->getName());
+    });
+
+    if (Parallel) {
+      annotateParallelLoop(L1, OrigLoopID, AddVectorizeHints, TTI);
+      NumParallel++;
+      LLVM_DEBUG(dbgs() << "Loop fuso annotato con parallel_accesses.\n");
+    }
+
+    // Rimuovo L2 dal loop info e dall'insieme in modo tale che non esista più,
+    // L1 resta la testa della catena. 
+    Set.erase(it2);
+    LI.erase(L2);
+    Changed = true;
   }
-  return false;
 
+  return Changed;
 }
 
 PreservedAnalyses LoopFusion::run(Function &F, FunctionAnalysisManager &AM) {
@@ -332,22 +1492,51 @@ PreservedAnalyses LoopFusion::run(Function &F, FunctionAnalysisManager &AM) {
   PostDominatorTree &PDT = AM.getResult<PostDominatorTreeAnalysis>(F);
   ScalarEvolution &SE = AM.getResult<ScalarEvolutionAnalysis>(F);
   DependenceInfo &DI = AM.getResult<DependenceAnalysis>(F);
-  
-  bool programChanged = false; // Variabile che, tracka se il programma cambia, continua a provare la loop fuse. 
-  std::list<Loop *> topLevelLoops;
-
-  do{
-    outs() << "----------- Loop da analizzare -----------\n";
-    topLevelLoops = getTopLevelLoops(LI, true); // Recupero i top level loops
-    // Se ci sono meno di due loop allora l'analisi termina
-    // Se la loop fusion ha restituito falso allora termino, altrimenti continuo. 
-    programChanged = (topLevelLoops.size() >= 2) ? tryLoopFusion(topLevelLoops, LI, DT, PDT, SE, DI) : false;
-    if(programChanged)
-      EliminateUnreachableBlocks(F); // Eliminazione blocchi irragiungibili
-    else
-      outs() << "Analisi dei loop completata.\n";
-    
-  }while(programChanged);
-
-  return PreservedAnalyses::all();
-}
\ No newline at end of file
+  TargetTransformInfo &TTI = AM.getResult<TargetIRAnalysis>(F);
+  OptimizationRemarkEmitter &ORE = AM.getResult<OptimizationRemarkEmitterAnalysis>(F);
+
+  // Gli aggiornamenti dei dominator tree vengono accumulati durante una fusione e applicati
+  // insieme prima di analizzare la coppia successiva. 
+  DomTreeUpdater DTU(DT, PDT, DomTreeUpdater::UpdateStrategy::Lazy);
+  bool Changed = false;
+
+  LLVM_DEBUG(dbgs() << "----------- Loop da analizzare -----------\n");
+
+  // Visito il loop forest dall'esterno verso l'interno, un gruppo di loop fratelli alla
+  // volta (nullptr indica i top level loops). Ogni gruppo viene diviso in insiemi
+  // control flow equivalent e ogni insieme viene fuso con un'unica passata. 
+  SmallVector<Loop *, 8> Parents = {nullptr};
+
+  while (!Parents.empty()) {
+    Loop *Parent = Parents.pop_back_val();
+    auto getSiblings = [&]() -> ArrayRef<Loop *> {
+      return Parent ? Parent->getSubLoops() : LI.getTopLevelLoops();
+    };
+
+    FusionCandidateCollection Candidates =
+        collectFusionCandidates(getSiblings(), DTU.getDomTree(), DTU.getPostDomTree(), ORE);
+
+    for (FusionCandidateSet &Set : Candidates)
+      if (Set.size() >= 2)
+        Changed |= fuseCandidateSet(Set, LI, DTU, SE, DI, TTI, ORE);
+
+    // Scendo di un livello: dopo la fusione di due nest i sottoloop di entrambi si
+    // trovano nel loop fuso. 
+    for (Loop *L : getSiblings())
+      if (!L->isInnermost())
+        Parents.push_back(L);
+  }
+
+  if (!Changed)
+    return PreservedAnalyses::all();
+
+  // LoopInfo e i dominator tree sono aggiornati durante la fusione, mentre di
+  // ScalarEvolution sono state invalidate solo le informazioni sui loop modificati. 
+  DTU.flush();
+  PreservedAnalyses PA;
+  PA.preserve<DominatorTreeAnalysis>();
+  PA.preserve<PostDominatorTreeAnalysis>();
+  PA.preserve<LoopAnalysis>();
+  PA.preserve<ScalarEvolutionAnalysis>();
+  return PA;
+}
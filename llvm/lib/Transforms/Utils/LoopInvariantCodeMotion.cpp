@@ -1,54 +1,148 @@
 #include "llvm/Transforms/Utils/LoopInvariantCodeMotion.h"
-#include <set>
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/CaptureTracking.h"
+#include "llvm/Analysis/LoopIterator.h"
+#include "llvm/Analysis/MemorySSA.h"
+#include "llvm/Analysis/MemorySSAUpdater.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Transforms/Utils/SSAUpdater.h"
 
 using namespace llvm;
 
-bool isInstructionLoopInvariant(Instruction &Inst, Loop &L);
+#define DEBUG_TYPE "my-licm"
 
-bool isValueLoopInvariant(Value *Val, Loop &L) {
+STATISTIC(NumLoopInvariant, "Number of loop invariant instructions found");
+STATISTIC(NumHoisted, "Number of instructions hoisted to the preheader");
+STATISTIC(NumNotSimplified, "Number of loops skipped because not in simplify form");
+STATISTIC(NumPromoted, "Number of memory locations promoted to registers");
+STATISTIC(NumSunk, "Number of instructions sunk into the exit blocks");
+STATISTIC(NumNotSpeculatedCold, "Number of invariant instructions not hoisted from cold blocks");
+STATISTIC(NumNotHoistedPressure, "Number of invariant instructions kept in the loop because of register pressure");
+
+static cl::opt<bool> EnableSpeculation(
+    "my-licm-speculate", cl::init(true), cl::Hidden,
+    cl::desc("Hoist speculatable invariants from blocks that do not dominate "
+             "the loop exits, guided by block frequencies"));
+
+static cl::opt<unsigned> SpeculationThreshold(
+    "my-licm-speculation-threshold", cl::init(100), cl::Hidden,
+    cl::desc("Minimum frequency of a block, as a percentage of the preheader "
+             "frequency, to speculatively hoist its invariants"));
+
+// Loop nest in cui si trova il loop corrente: Nest[0] è il loop stesso, Nest[j+1]
+// è il parent di Nest[j]. Contiene solo loop in simplify form (con un preheader).
+using LoopChain = SmallVector<Loop *, 4>;
+
+// Per ogni istruzione del loop: livello del nest più esterno nel cui preheader
+// può essere spostata (-1 se non è loop invariant nemmeno nel loop corrente).
+using HoistLevels = DenseMap<Instruction *, int>;
+
+LoopChain getLoopChain(Loop &L) {
   /*
-  Funzione che controlla che l'operando sia loop invariant.
+  Funzione che risale i parent del loop finché sono in simplify form.
   */
+  LoopChain Nest = {&L};
+  for (Loop *P = L.getParentLoop(); P and P->isLoopSimplifyForm(); P = P->getParentLoop())
+    Nest.push_back(P);
+  return Nest;
+}
 
-  // Se l'operando è una costante oppure è un argument della function allora restituisco true. 
-  if (isa<ConstantInt>(Val) or isa<Argument>(Val))
-    return true;
+int getNestDepth(BasicBlock *BB, const LoopChain &Nest) {
+  /*
+  Funzione che restituisce il livello del loop più interno del nest che contiene
+  il blocco, oppure Nest.size() se il blocco è fuori da tutto il nest.
+  */
+  for (unsigned j = 0; j < Nest.size(); j++)
+    if (Nest[j]->contains(BB))
+      return j;
+  return Nest.size();
+}
+
+int getValueLevel(Value *Val, const LoopChain &Nest, const HoistLevels &Levels) {
+  /*
+  Funzione che restituisce il livello più esterno del nest in cui l'operando è
+  loop invariant.
+  */
+
+  // Se l'operando è una costante (anche l'indirizzo di una globale) oppure è un
+  // argument della function allora è invariante in tutto il nest. 
+  if (isa<Constant>(Val) or isa<Argument>(Val))
+    return Nest.size() - 1;
 
   // Trovo la reaching definition dell'operando e...
   Instruction *I = dyn_cast<Instruction>(Val);
+  if (!I)
+    return -1;
 
-  //... se è un phinode restituisco falso.
-  if (!I or isa<PHINode>(Val))
-    return false;
+  //... se la reaching definition si trova in Nest[j] ma fuori da Nest[j-1] allora
+  // è invariante in tutti i loop più interni di Nest[j] (anche se è un phi). 
+  int Depth = getNestDepth(I->getParent(), Nest);
+  if (Depth > 0)
+    return Depth - 1;
 
-  //... se la reaching definition si trova al di fuori del loop allora l'instruzione sarà loop invariant. 
-  if (!L.contains(I))
-    return true;
+  //... altrimenti è nel loop corrente: conta il livello già calcolato per la sua
+  // reaching definition. Visitando il loop in RPO la definizione viene sempre
+  // analizzata prima dei suoi usi (esclusi i phi, che non sono mai invarianti).
+  auto It = Levels.find(I);
+  return It == Levels.end() ? -1 : It->second;
+}
+
+int getInstructionLevel(Instruction &Inst, const LoopChain &Nest,
+                        const HoistLevels &Levels) {
+  /*
+  Funzione che restituisce il livello più esterno del nest in cui l'istruzione è
+  loop invariant, cioè il minimo tra i livelli dei suoi operandi. 
+  */
+  if (isa<PHINode>(Inst)) // Un phi node del loop non è mai loop invariant. 
+    return -1;
+
+  int Level = Nest.size() - 1;
+  for (auto OI = Inst.op_begin(); OI != Inst.op_end() and Level >= 0; OI++)
+    Level = std::min(Level, getValueLevel(*OI, Nest, Levels));
 
-  //... altrimenti dovrò controllare a sua volta che l'istruzione sia loop invariant o no. 
-  // Se infatti a sua volta l'operando ha una reaching definition nel loop che è loop invariant allora
-  // sarà loop invariant altrimenti no. 
-  return isInstructionLoopInvariant(*I, L);
+  return Level;
 }
 
-bool isInstructionLoopInvariant(Instruction &Inst, Loop &L) {
+int getLoadLevel(LoadInst &Load, const LoopChain &Nest, AAResults &AA, MemorySSA *MSSA,
+                 ArrayRef<std::pair<Instruction *, int>> NestWriters) {
   /*
-  Funzione che restituisce true se l'istruzione è loop invariant, false altrimenti. 
+  Funzione che restituisce il livello più esterno del nest in cui nessuna
+  istruzione può modificare la locazione letta dalla load.
+  - Con MemorySSA: la definizione che "clobbera" la load deve trovarsi fuori dal loop.
+  - Senza MemorySSA: nessuna istruzione che scrive in memoria nel loop deve
+    poter modificare (secondo l'alias analysis) la locazione della load.
   */
-  if (isa<PHINode>(Inst)) // Un phi node non è mai loop invariant. 
-    return false;
+  if (!Load.isSimple())
+    return -1;
 
-  // Controllo che ogni operando sia loop invariant, se anche solo uno non lo è l'istruzione NON è loop invariant. 
-  for (auto OI = Inst.op_begin(); OI != Inst.op_end(); OI++) {
-    Value *Val = *OI;
-    if (!isValueLoopInvariant(Val, L))
-      return false;
+  if (MSSA) {
+    MemoryAccess *Clobber = MSSA->getWalker()->getClobberingMemoryAccess(&Load);
+    if (MSSA->isLiveOnEntryDef(Clobber))
+      return Nest.size() - 1;
+    return getNestDepth(Clobber->getBlock(), Nest) - 1;
   }
 
-  return true;
+  // Una store che si trova in Nest[j] impedisce di spostare la load fuori da Nest[j].
+  int Level = Nest.size() - 1;
+  MemoryLocation Loc = MemoryLocation::get(&Load);
+  for (auto &Writer : NestWriters)
+    if (Writer.second <= Level and isModSet(AA.getModRefInfo(Writer.first, Loc)))
+      Level = Writer.second - 1;
+  return Level;
 }
 
-bool dominatesAllExits(Instruction &Inst, std::set<BasicBlock *> LoopExitBB,
+bool dominatesAllExits(Instruction &Inst, ArrayRef<BasicBlock *> LoopExitBB,
                        DominatorTree &DT) {
   /*
   Funzione che restituisce true se il blocco a cui appartiene domina tutte le uscite, altrimenti false. 
@@ -71,67 +165,774 @@ bool isLoopDead(Instruction &Inst, Loop &L) {
   return true;
 }
 
+bool isHotEnoughToSpeculate(BasicBlock *BB, BasicBlock *PreHeader,
+                            BlockFrequencyInfo &BFI) {
+  /*
+  Funzione che controlla, con le frequenze dei blocchi (stimate o da profilo), che
+  il blocco venga eseguito abbastanza spesso rispetto al preheader:
+    freq(BB) / freq(PreHeader) >= SpeculationThreshold / 100
+  Spostare nel preheader un calcolo che si trova su un ramo freddo lo renderebbe
+  più costoso invece che meno.
+  */
+  uint64_t BBFreq = BFI.getBlockFreq(BB).getFrequency();
+  uint64_t PHFreq = BFI.getBlockFreq(PreHeader).getFrequency();
+  return SaturatingMultiply(BBFreq, uint64_t(100)) >=
+         SaturatingMultiply(PHFreq, uint64_t(SpeculationThreshold));
+}
+
+bool canHoistOutOf(Instruction &Inst, Loop &L, ArrayRef<BasicBlock *> ExitingBlocks,
+                   bool Speculatable, DominatorTree &DT, BlockFrequencyInfo *BFI) {
+  /*
+  Funzione che controlla se l'istruzione (loop invariant) può essere spostata nel
+  preheader di L:
+  - se si trova in un blocco che domina tutte le uscite del loop viene sempre eseguita;
+  - altrimenti va eseguita speculativamente (non deve poter fare fault, es. una load):
+    - con le frequenze dei blocchi, solo se il blocco è abbastanza "caldo";
+    - senza, solo se non ha usi dopo il loop.
+  */
+  if (dominatesAllExits(Inst, ExitingBlocks, DT))
+    return true;
+
+  if (!Speculatable)
+    return false;
+
+  if (EnableSpeculation and BFI)
+    return isHotEnoughToSpeculate(Inst.getParent(), L.getLoopPreheader(), *BFI);
+
+  return isLoopDead(Inst, L);
+}
+
+void computeHoistLevels(Loop &L, const LoopChain &Nest, LoopStandardAnalysisResults &LAR,
+                        BlockFrequencyInfo *BFI, OptimizationRemarkEmitter &ORE,
+                        HoistLevels &Levels, SmallVectorImpl<Instruction *> &ToHoist) {
+  /*
+  Funzione che calcola, con un'unica visita in reverse post order dei blocchi del
+  loop, il loop più esterno del nest da cui ogni istruzione può essere spostata.
+  Il livello di un'istruzione dipende solo dai livelli (già calcolati) dei suoi
+  operandi, quindi lo stesso risultato vale per tutti i livelli del nest e
+  un'espressione invariante in tutto il nest viene spostata direttamente nel
+  preheader più esterno, invece di salire di un livello ogni volta che il passo
+  visita un loop.
+  Le istruzioni da spostare vengono restituite in RPO: le definizioni precedono
+  sempre gli usi, quindi possono essere inserite nei preheader in quest'ordine.
+  */
+  LoopBlocksRPO RPO(&L);
+  RPO.perform(&LAR.LI);
+
+  // Uscite di ogni loop del nest.
+  SmallVector<SmallVector<BasicBlock *, 4>, 4> NestExitingBlocks(Nest.size());
+  for (unsigned j = 0; j < Nest.size(); j++)
+    Nest[j]->getExitingBlocks(NestExitingBlocks[j]);
+
+  // Istruzioni del nest che possono scrivere in memoria, con il livello del loop
+  // più interno che le contiene (usate senza MemorySSA).
+  SmallVector<std::pair<Instruction *, int>, 16> NestWriters;
+  if (!LAR.MSSA)
+    for (BasicBlock *BB : Nest.back()->blocks())
+      for (Instruction &Inst : *BB)
+        if (Inst.mayWriteToMemory())
+          NestWriters.push_back({&Inst, getNestDepth(BB, Nest)});
+
+  for (BasicBlock *BB : RPO)
+    for (Instruction &Inst : *BB) {
+      int Level = getInstructionLevel(Inst, Nest, Levels);
+      if (Level < 0)
+        continue;
+
+      // Le load sono invarianti solo se nessuna store del loop le "clobbera",
+      // mentre store, call e istruzioni con side effect non vengono mai spostate.
+      if (LoadInst *Load = dyn_cast<LoadInst>(&Inst))
+        Level = std::min(Level, getLoadLevel(*Load, Nest, LAR.AA, LAR.MSSA, NestWriters));
+      else if (Inst.mayReadOrWriteMemory() or Inst.mayHaveSideEffects())
+        continue;
+
+      if (Level < 0)
+        continue;
+      NumLoopInvariant++;
+
+      // Scendo dal livello più esterno finché lo spostamento non è sicuro (e,
+      // se speculativo, conveniente).
+      bool Speculatable = isSafeToSpeculativelyExecute(&Inst);
+      while (Level >= 0 and !canHoistOutOf(Inst, *Nest[Level], NestExitingBlocks[Level],
+                                           Speculatable, LAR.DT, BFI))
+        Level--;
+
+      if (Level < 0 and Speculatable and EnableSpeculation and BFI) {
+        NumNotSpeculatedCold++;
+        ORE.emit([&]() {
+          return OptimizationRemarkMissed(DEBUG_TYPE, "ColdBlock", &Inst)
+                 << "invariant instruction not hoisted: its block does not run "
+                    "often enough relative to the preheader";
+        });
+        continue;
+      }
+
+      if (Level < 0) {
+        ORE.emit([&]() {
+          return OptimizationRemarkMissed(DEBUG_TYPE, "NotDominatingExits", &Inst)
+                 << "invariant instruction not hoisted: it does not dominate "
+                    "all loop exits and is used after the loop";
+        });
+        continue;
+      }
+
+      Levels[&Inst] = Level;
+      ToHoist.push_back(&Inst);
+    }
+}
+
+// Numero di valori vivi per tutto il loop, per classe di registri.
+using RegisterPressure = SmallDenseMap<unsigned, int, 4>;
+
+bool needsRegister(Value *V) {
+  /*
+  Funzione che restituisce true se il valore occupa un registro (le costanti
+  vengono materializzate dove servono).
+  */
+  if (!isa<Instruction>(V) and !isa<Argument>(V))
+    return false;
+  Type *Ty = V->getType();
+  return Ty->isIntOrIntVectorTy() or Ty->isFPOrFPVectorTy() or Ty->isPtrOrPtrVectorTy();
+}
+
+unsigned getRegisterClass(Value *V, const TargetTransformInfo &TTI) {
+  return TTI.getRegisterClassForType(V->getType()->isVectorTy(), V->getType());
+}
+
+bool isLiveThroughLoop(Value *V, Loop &L, const SmallPtrSetImpl<Instruction *> &Hoisted) {
+  /*
+  Funzione che stima se il valore occupa un registro per tutto il loop:
+  - un valore definito fuori dal loop (o spostato nel preheader) lo è se ha usi nel
+    loop che non vengono a loro volta spostati;
+  - un'istruzione spostata lo è anche se ha usi dopo il loop.
+  I valori temporanei calcolati nel loop non cambiano con la code motion e non
+  vengono contati.
+  */
+  Instruction *I = dyn_cast<Instruction>(V);
+  bool IsHoisted = I and Hoisted.count(I);
+  if (I and L.contains(I) and !IsHoisted)
+    return false;
+
+  for (Use &U : V->uses()) {
+    Instruction *UI = dyn_cast<Instruction>(U.getUser());
+    if (!UI or Hoisted.count(UI))
+      continue;
+
+    // Il valore iniziale di un phi dell'header serve solo all'ingresso del loop.
+    PHINode *PN = dyn_cast<PHINode>(UI);
+    if (PN and PN->getParent() == L.getHeader() and !L.contains(PN->getIncomingBlock(U)))
+      continue;
+
+    if (L.contains(UI) or IsHoisted)
+      return true;
+  }
+  return false;
+}
+
+RegisterPressure getLoopRegisterPressure(Loop &L, const TargetTransformInfo &TTI) {
+  /*
+  Funzione che stima la pressione sui registri del loop prima della code motion:
+  i phi dell'header (valori loop carried) e i valori definiti fuori dal loop che
+  vengono usati al suo interno.
+  */
+  RegisterPressure Pressure;
+  SmallPtrSet<Instruction *, 1> NoHoisted;
+  SmallPtrSet<Value *, 32> Visited;
+
+  for (PHINode &PN : L.getHeader()->phis())
+    if (needsRegister(&PN))
+      Pressure[getRegisterClass(&PN, TTI)]++;
+
+  for (BasicBlock *BB : L.blocks())
+    for (Instruction &Inst : *BB)
+      for (Value *Op : Inst.operands()) {
+        Instruction *OpInst = dyn_cast<Instruction>(Op);
+        if (!needsRegister(Op) or (OpInst and L.contains(OpInst)) or
+            !Visited.insert(Op).second)
+          continue;
+        if (isLiveThroughLoop(Op, L, NoHoisted))
+          Pressure[getRegisterClass(Op, TTI)]++;
+      }
+
+  return Pressure;
+}
+
+bool tryHoistWithinBudget(ArrayRef<Instruction *> Closure, Loop &L,
+                          const TargetTransformInfo &TTI, RegisterPressure &Pressure,
+                          SmallPtrSetImpl<Instruction *> &Hoisted) {
+  /*
+  Funzione che aggiunge all'insieme delle istruzioni da spostare una radice con i
+  suoi operandi (Closure) solo se la pressione stimata su ogni classe di registri
+  resta entro il numero di registri del target. Spostare un'istruzione può anche
+  ridurre la pressione, se i suoi operandi esterni al loop non hanno altri usi.
+  */
+
+  // Valori il cui stato (vivo per tutto il loop o no) può cambiare.
+  SmallSetVector<Value *, 16> Affected;
+  for (Instruction *I : Closure) {
+    Affected.insert(I);
+    for (Value *Op : I->operands()) {
+      Instruction *OpInst = dyn_cast<Instruction>(Op);
+      if (needsRegister(Op) and (!OpInst or !L.contains(OpInst) or Hoisted.count(OpInst)))
+        Affected.insert(Op);
+    }
+  }
+
+  RegisterPressure Delta;
+  for (Value *V : Affected)
+    if (needsRegister(V) and isLiveThroughLoop(V, L, Hoisted))
+      Delta[getRegisterClass(V, TTI)]--;
+
+  Hoisted.insert(Closure.begin(), Closure.end());
+
+  for (Value *V : Affected)
+    if (needsRegister(V) and isLiveThroughLoop(V, L, Hoisted))
+      Delta[getRegisterClass(V, TTI)]++;
+
+  bool WithinBudget = all_of(Delta, [&](auto &Entry) {
+    return Entry.second <= 0 or
+           Pressure[Entry.first] + Entry.second <=
+               int(TTI.getNumberOfRegisters(Entry.first));
+  });
+
+  if (!WithinBudget) {
+    for (Instruction *I : Closure)
+      Hoisted.erase(I);
+    return false;
+  }
+
+  for (auto &Entry : Delta)
+    Pressure[Entry.first] += Entry.second;
+  return true;
+}
+
+void limitRegisterPressure(Loop &L, LoopStandardAnalysisResults &LAR,
+                           BlockFrequencyInfo *BFI, const HoistLevels &Levels,
+                           OptimizationRemarkEmitter &ORE,
+                           SmallVectorImpl<Instruction *> &ToHoist) {
+  /*
+  Funzione che limita la code motion in base alla pressione sui registri: ogni
+  valore spostato nel preheader resta vivo per tutto il loop e, se i registri non
+  bastano, gli spill costano più delle istruzioni risparmiate.
+  Le candidate vengono raggruppate per "radice" (un'istruzione con usi che non
+  vengono spostati) insieme agli operandi che vanno spostati con lei, e ordinate
+  per beneficio (frequenza del blocco * costo). Le radici vengono accettate finché
+  la pressione stimata resta entro i registri del target; le altre restano nel
+  loop e vengono ricalcolate ad ogni iterazione (rematerializzazione).
+  */
+  const TargetTransformInfo &TTI = LAR.TTI;
+  const auto CostKind = TargetTransformInfo::TCK_SizeAndLatency;
+
+  auto getBenefit = [&](Instruction *I) {
+    uint64_t Freq = BFI ? BFI->getBlockFreq(I->getParent()).getFrequency() : 1;
+    return TTI.getInstructionCost(I, CostKind) * Freq;
+  };
+
+  auto collectClosure = [&](Instruction *Root, const SmallPtrSetImpl<Instruction *> &Hoisted,
+                            SmallSetVector<Instruction *, 8> &Closure) {
+    SmallVector<Instruction *, 8> Worklist = {Root};
+    while (!Worklist.empty()) {
+      Instruction *I = Worklist.pop_back_val();
+      if (Hoisted.count(I) or !Closure.insert(I))
+        continue;
+      for (Value *Op : I->operands())
+        if (Instruction *OpInst = dyn_cast<Instruction>(Op))
+          if (Levels.count(OpInst))
+            Worklist.push_back(OpInst);
+    }
+  };
+
+  // Radici in ordine di beneficio decrescente (a parità, in RPO).
+  SmallVector<std::pair<Instruction *, InstructionCost>, 16> Roots;
+  SmallPtrSet<Instruction *, 1> NoHoisted;
+  for (Instruction *I : ToHoist) {
+    bool IsRoot = I->use_empty() or any_of(I->users(), [&](User *U) {
+      return !Levels.count(cast<Instruction>(U));
+    });
+    if (!IsRoot)
+      continue;
+
+    SmallSetVector<Instruction *, 8> Closure;
+    collectClosure(I, NoHoisted, Closure);
+    InstructionCost Benefit = 0;
+    for (Instruction *CI : Closure)
+      Benefit += getBenefit(CI);
+    Roots.push_back({I, Benefit});
+  }
+  stable_sort(Roots, [](auto &A, auto &B) { return A.second > B.second; });
+
+  RegisterPressure Pressure = getLoopRegisterPressure(L, TTI);
+  SmallPtrSet<Instruction *, 32> Hoisted;
+
+  for (auto &Root : Roots) {
+    Instruction *I = Root.first;
+    SmallSetVector<Instruction *, 8> Closure;
+    collectClosure(I, Hoisted, Closure);
+    if (Closure.empty() or
+        tryHoistWithinBudget(Closure.getArrayRef(), L, TTI, Pressure, Hoisted))
+      continue;
+
+    NumNotHoistedPressure++;
+    bool Cheap = TTI.getInstructionCost(I, CostKind) <= TargetTransformInfo::TCC_Basic;
+    ORE.emit([&]() {
+      OptimizationRemarkMissed R(DEBUG_TYPE, "RegisterPressure", I);
+      R << "invariant instruction not hoisted: not enough registers to keep it "
+           "live across the loop";
+      if (Cheap)
+        R << ", it is cheap to rematerialize in the loop";
+      return R;
+    });
+  }
+
+  // Mantengo l'ordine (RPO) delle candidate: le definizioni precedono gli usi.
+  erase_if(ToHoist, [&](Instruction *I) { return !Hoisted.count(I); });
+}
+
+bool canSinkInstruction(Instruction &Inst) {
+  /*
+  Funzione che controlla che l'istruzione possa essere ricalcolata in un exit block
+  invece che ad ogni iterazione: non deve accedere alla memoria (il valore letto
+  potrebbe cambiare dopo) né avere side effect. 
+  */
+  if (isa<PHINode>(Inst) or Inst.isTerminator() or Inst.isEHPad() or isa<AllocaInst>(Inst))
+    return false;
+
+  if (Inst.mayReadOrWriteMemory() or Inst.mayHaveSideEffects())
+    return false;
+
+  if (CallBase *CB = dyn_cast<CallBase>(&Inst))
+    if (CB->isConvergent())
+      return false;
+
+  // Le istruzioni senza usi sono lasciate alla DCE.
+  return !Inst.use_empty();
+}
+
+bool isExitPHIOf(Instruction &User, Instruction &Inst, Loop &L) {
+  /*
+  Funzione che restituisce true se User è un phi LCSSA di un exit block che
+  riceve Inst da tutti i predecessori (che quindi sono blocchi del loop).
+  */
+  PHINode *PN = dyn_cast<PHINode>(&User);
+  if (!PN or L.contains(PN))
+    return false;
+
+  for (unsigned i = 0; i < PN->getNumIncomingValues(); i++)
+    if (PN->getIncomingValue(i) != &Inst or !L.contains(PN->getIncomingBlock(i)))
+      return false;
+  return true;
+}
+
+Value *getValueInExitBlock(Instruction *Inst, BasicBlock *ExitBlock, Instruction *InsertPt,
+                           Loop &L, const SmallPtrSetImpl<Instruction *> &Sinkable,
+                           DenseMap<Instruction *, Value *> &ExitValues) {
+  /*
+  Funzione che restituisce il valore che Inst (definita nel loop) ha nell'exit block:
+  - se Inst viene affondata, un suo clone inserito nell'exit block (con gli operandi
+    a loro volta risolti ricorsivamente);
+  - altrimenti un phi LCSSA che riceve Inst dai predecessori dell'exit block.
+  */
+  auto It = ExitValues.find(Inst);
+  if (It != ExitValues.end())
+    return It->second;
+
+  Value *Result = nullptr;
+
+  if (Sinkable.count(Inst)) {
+    Instruction *Clone = Inst->clone();
+    Clone->setName(Inst->getName() + ".sunk");
+
+    for (Use &Op : Clone->operands()) {
+      Instruction *OpInst = dyn_cast<Instruction>(Op.get());
+      if (OpInst and L.contains(OpInst))
+        Op.set(getValueInExitBlock(OpInst, ExitBlock, InsertPt, L, Sinkable, ExitValues));
+    }
+
+    // Gli operandi clonati sono già stati inseriti prima di InsertPt.
+    Clone->insertBefore(InsertPt);
+    Result = Clone;
+  } else {
+    // Riuso il phi LCSSA se esiste già.
+    for (PHINode &PN : ExitBlock->phis())
+      if (isExitPHIOf(PN, *Inst, L)) {
+        Result = &PN;
+        break;
+      }
+
+    if (!Result) {
+      PHINode *PN = PHINode::Create(Inst->getType(), pred_size(ExitBlock),
+                                    Inst->getName() + ".lcssa", &ExitBlock->front());
+      for (BasicBlock *Pred : predecessors(ExitBlock))
+        PN->addIncoming(Inst, Pred);
+      Result = PN;
+    }
+  }
+
+  ExitValues[Inst] = Result;
+  return Result;
+}
+
+bool sinkToExitBlocks(Loop &L, LoopStandardAnalysisResults &LAR,
+                      OptimizationRemarkEmitter &ORE) {
+  /*
+  Sinking: un'istruzione calcolata ad ogni iterazione ma usata solo dopo il loop
+  viene spostata (clonata) negli exit block, dove viene eseguita una volta sola.
+    loop:  %x = mul %i, %k          exit:  %i.lcssa = phi [%i, %loop]
+    exit:  %x.lcssa = phi [%x, %loop]  ->  %x.sunk = mul %i.lcssa, %k
+  Un'istruzione può essere affondata se ogni suo uso è:
+  - un phi LCSSA di un exit block che riceve l'istruzione da tutti i predecessori, oppure
+  - un'istruzione del loop che a sua volta viene affondata.
+  Dato che l'istruzione domina tutti i predecessori dell'exit block, ricalcolarla
+  lì con gli operandi dell'ultima iterazione produce lo stesso valore.
+  */
+  LoopBlocksDFS DFS(&L);
+  DFS.perform(&LAR.LI);
+
+  // Visito il loop in post order (e i blocchi dal fondo): gli usi di un'istruzione
+  // vengono analizzati prima della sua definizione.
+  SmallPtrSet<Instruction *, 16> Sinkable;
+  SmallVector<Instruction *, 16> SinkOrder;
+
+  for (auto BI = DFS.beginPostorder(); BI != DFS.endPostorder(); ++BI)
+    for (Instruction &Inst : reverse(**BI)) {
+      if (!canSinkInstruction(Inst))
+        continue;
+
+      bool AllUsesSinkable = all_of(Inst.users(), [&](User *U) {
+        Instruction *UI = cast<Instruction>(U);
+        return L.contains(UI) ? Sinkable.count(UI) : isExitPHIOf(*UI, Inst, L);
+      });
+
+      if (AllUsesSinkable) {
+        Sinkable.insert(&Inst);
+        SinkOrder.push_back(&Inst);
+      }
+    }
+
+  if (Sinkable.empty())
+    return false;
+
+  SmallVector<BasicBlock *, 4> ExitBlocks;
+  L.getUniqueExitBlocks(ExitBlocks);
+
+  for (BasicBlock *ExitBlock : ExitBlocks) {
+    if (ExitBlock->getFirstInsertionPt() == ExitBlock->end())
+      continue;
+    Instruction *InsertPt = &*ExitBlock->getFirstInsertionPt();
+
+    SmallVector<PHINode *, 4> ExitPHIs;
+    for (PHINode &PN : ExitBlock->phis()) {
+      Instruction *I = dyn_cast<Instruction>(PN.getIncomingValue(0));
+      if (I and Sinkable.count(I) and isExitPHIOf(PN, *I, L))
+        ExitPHIs.push_back(&PN);
+    }
+
+    // Valori già materializzati in questo exit block.
+    DenseMap<Instruction *, Value *> ExitValues;
+    for (PHINode *PN : ExitPHIs) {
+      Instruction *I = cast<Instruction>(PN->getIncomingValue(0));
+      PN->replaceAllUsesWith(
+          getValueInExitBlock(I, ExitBlock, InsertPt, L, Sinkable, ExitValues));
+      PN->eraseFromParent();
+    }
+  }
+
+  // Cancello le istruzioni originali partendo dagli usi: restano nel loop solo
+  // quelle ancora usate da un exit block in cui non è stato possibile inserirle.
+  bool Changed = false;
+  for (Instruction *Inst : SinkOrder) {
+    if (!Inst->use_empty())
+      continue;
+    ORE.emit([&]() {
+      return OptimizationRemark(DEBUG_TYPE, "Sunk", Inst)
+             << "sinking " << ore::NV("Inst", Inst);
+    });
+    Inst->eraseFromParent();
+    NumSunk++;
+    Changed = true;
+  }
+
+  return Changed;
+}
+
+// Promoter che, oltre a riscrivere load e store del loop con valori SSA,
+// inserisce una store del valore finale in ogni exit block e mantiene
+// aggiornata MemorySSA per le istruzioni create e cancellate.
+class LoopPromoter : public LoadAndStorePromoter {
+  Value *Ptr;
+  Loop &L;
+  SSAUpdater &SSA;
+  ArrayRef<BasicBlock *> ExitBlocks;
+  Align Alignment;
+  MemorySSAUpdater *MSSAU;
+
+public:
+  LoopPromoter(Value *Ptr, ArrayRef<const Instruction *> Insts, Loop &L,
+               SSAUpdater &SSA, ArrayRef<BasicBlock *> ExitBlocks,
+               Align Alignment, MemorySSAUpdater *MSSAU)
+      : LoadAndStorePromoter(Insts, SSA), Ptr(Ptr), L(L), SSA(SSA),
+        ExitBlocks(ExitBlocks), Alignment(Alignment), MSSAU(MSSAU) {}
+
+  Value *insertLCSSAPHI(Value *V, BasicBlock *ExitBlock) const {
+    /*
+    Il valore usato nell'exit block deve passare da un phi (forma LCSSA)
+    se è definito all'interno del loop.
+    */
+    Instruction *I = dyn_cast<Instruction>(V);
+    if (!I or !L.contains(I))
+      return V;
+
+    PHINode *PN = PHINode::Create(I->getType(), pred_size(ExitBlock),
+                                  I->getName() + ".lcssa", &ExitBlock->front());
+    for (BasicBlock *Pred : predecessors(ExitBlock))
+      PN->addIncoming(I, Pred);
+    return PN;
+  }
+
+  void doExtraRewritesBeforeFinalDeletion() override {
+    for (BasicBlock *ExitBlock : ExitBlocks) {
+      Value *LiveOut = insertLCSSAPHI(SSA.GetValueInMiddleOfBlock(ExitBlock), ExitBlock);
+      StoreInst *NewSI = new StoreInst(LiveOut, Ptr, false, Alignment,
+                                       &*ExitBlock->getFirstInsertionPt());
+      if (MSSAU) {
+        MemoryAccess *NewMA = MSSAU->createMemoryAccessInBB(
+            NewSI, nullptr, ExitBlock, MemorySSA::Beginning);
+        MSSAU->insertDef(cast<MemoryDef>(NewMA), true);
+      }
+    }
+  }
+
+  void instructionDeleted(Instruction *I) const override {
+    if (MSSAU)
+      MSSAU->removeMemoryAccess(I);
+  }
+};
+
+bool isNonEscapingLocal(Value *Ptr) {
+  /*
+  Funzione che controlla se l'indirizzo appartiene a una variabile locale (alloca) il cui
+  indirizzo non viene mai salvato o passato ad altre funzioni: solo la function corrente
+  può osservarne il contenuto, quindi se il loop viene abbandonato con un'eccezione la
+  store mancante non è visibile a nessuno.
+  */
+  const Value *Obj = getUnderlyingObject(Ptr);
+  return isa<AllocaInst>(Obj) and
+         !PointerMayBeCaptured(Obj, /*ReturnCaptures=*/true, /*StoreCaptures=*/true);
+}
+
+bool promoteLoopAccesses(Loop &L, LoopStandardAnalysisResults &LAR,
+                         MemorySSAUpdater *MSSAU, OptimizationRemarkEmitter &ORE) {
+  /*
+  Scalar promotion: se una locazione con indirizzo loop invariant viene letta e
+  scritta ad ogni iterazione, viene tenuta in un registro per tutto il loop.
+    preheader:  %p.promoted = load %p
+    loop:       load/store di %p  -> valori SSA (phi nell'header)
+    exit:       store del valore finale in %p
+  È possibile solo se:
+  - tutti gli accessi sono load/store semplici dello stesso tipo allo stesso indirizzo;
+  - nessun'altra istruzione del loop può leggere o scrivere la locazione;
+  - almeno una store domina tutti gli exiting blocks (viene sempre eseguita), così
+    la load nel preheader e le store negli exit block non introducono accessi nuovi;
+  - il loop non può essere abbandonato senza passare da un exit block (nessuna istruzione
+    può lanciare un'eccezione o non ritornare), altrimenti il valore scritto nel loop non
+    arriverebbe mai in memoria. Fanno eccezione le variabili locali che non escono dalla
+    function (isNonEscapingLocal).
+  */
+  BasicBlock *PreHeader = L.getLoopPreheader();
+  const DataLayout &DL = PreHeader->getModule()->getDataLayout();
+
+  SmallVector<BasicBlock *, 4> ExitingBlocks, ExitBlocks;
+  L.getExitingBlocks(ExitingBlocks);
+  L.getUniqueExitBlocks(ExitBlocks);
+
+  // Gli exit block devono avere solo predecessori nel loop (dedicated exits).
+  if (!L.hasDedicatedExits() or ExitBlocks.empty())
+    return false;
+  for (BasicBlock *ExitBlock : ExitBlocks)
+    if (ExitBlock->getFirstInsertionPt() == ExitBlock->end())
+      return false;
+
+  // Raggruppo gli accessi per indirizzo (in ordine deterministico).
+  MapVector<Value *, SmallVector<Instruction *, 4>> Accesses;
+  SmallVector<Instruction *, 16> MemInsts;
+
+  for (BasicBlock *BB : L.blocks())
+    for (Instruction &Inst : *BB) {
+      if (!Inst.mayReadOrWriteMemory())
+        continue;
+      MemInsts.push_back(&Inst);
+
+      Value *Ptr = getLoadStorePointerOperand(&Inst);
+      if (Ptr and L.isLoopInvariant(Ptr))
+        Accesses[Ptr].push_back(&Inst);
+    }
+
+  // Istruzioni (es. call) da cui l'esecuzione potrebbe non proseguire nel loop.
+  bool MayThrow = false;
+  for (BasicBlock *BB : L.blocks())
+    for (Instruction &Inst : *BB)
+      if (!isGuaranteedToTransferExecutionToSuccessor(&Inst))
+        MayThrow = true;
+
+  bool Changed = false;
+
+  for (auto &Entry : Accesses) {
+    Value *Ptr = Entry.first;
+    SmallVector<Instruction *, 4> &Insts = Entry.second;
+
+    Type *Ty = getLoadStoreType(Insts.front());
+    Align Alignment = getLoadStoreAlignment(Insts.front());
+    bool GuaranteedStore = false;
+    bool Promotable = true;
+
+    for (Instruction *Inst : Insts) {
+      bool Simple = isa<LoadInst>(Inst) ? cast<LoadInst>(Inst)->isSimple()
+                                        : cast<StoreInst>(Inst)->isSimple();
+      if (!Simple or getLoadStoreType(Inst) != Ty or
+          (isa<StoreInst>(Inst) and Inst->getOperand(0) == Ptr)) {
+        Promotable = false;
+        break;
+      }
+      Alignment = std::min(Alignment, getLoadStoreAlignment(Inst));
+
+      if (isa<StoreInst>(Inst) and
+          all_of(ExitingBlocks, [&](BasicBlock *Exiting) {
+            return LAR.DT.dominates(Inst->getParent(), Exiting);
+          }))
+        GuaranteedStore = true;
+    }
+
+    if (!Promotable or !GuaranteedStore or !DL.typeSizeEqualsStoreSize(Ty))
+      continue;
+
+    if (MayThrow and !isNonEscapingLocal(Ptr)) {
+      ORE.emit([&]() {
+        return OptimizationRemarkMissed(DEBUG_TYPE, "PromoteLoopMayThrow", Insts.front())
+               << "not promoting memory location: the loop may exit without reaching "
+                  "the exit blocks";
+      });
+      continue;
+    }
+
+    // Nessun altro accesso del loop deve poter toccare la locazione.
+    MemoryLocation Loc = MemoryLocation::get(Insts.front());
+    SmallPtrSet<Instruction *, 4> Group(Insts.begin(), Insts.end());
+    if (any_of(MemInsts, [&](Instruction *Other) {
+          return !Group.count(Other) and
+                 isModOrRefSet(LAR.AA.getModRefInfo(Other, Loc));
+        }))
+      continue;
+
+    SmallVector<const Instruction *, 4> ConstInsts(Insts.begin(), Insts.end());
+    SmallVector<PHINode *, 8> NewPHIs;
+    SSAUpdater SSA(&NewPHIs);
+    LoopPromoter Promoter(Ptr, ConstInsts, L, SSA, ExitBlocks, Alignment, MSSAU);
+
+    LoadInst *PreheaderLoad =
+        new LoadInst(Ty, Ptr, Ptr->getName() + ".promoted", false, Alignment,
+                     PreHeader->getTerminator());
+    if (MSSAU) {
+      MemoryAccess *NewMA = MSSAU->createMemoryAccessInBB(
+          PreheaderLoad, nullptr, PreHeader, MemorySSA::End);
+      MSSAU->insertUse(cast<MemoryUse>(NewMA), true);
+    }
+    SSA.AddAvailableValue(PreHeader, PreheaderLoad);
+
+    ORE.emit([&]() {
+      return OptimizationRemark(DEBUG_TYPE, "PromoteLoopAccessesToScalar",
+                                Insts.front())
+             << "moving accesses to memory location out of the loop";
+    });
+
+    Promoter.run(Insts);
+    NumPromoted++;
+    Changed = true;
+
+    // La load nel preheader può risultare inutile se il loop non legge mai la locazione.
+    if (PreheaderLoad->use_empty()) {
+      if (MSSAU)
+        MSSAU->removeMemoryAccess(PreheaderLoad);
+      PreheaderLoad->eraseFromParent();
+    }
+
+    // Gli accessi promossi sono stati cancellati: aggiorno l'elenco per i gruppi successivi.
+    erase_if(MemInsts, [&](Instruction *I) { return Group.count(I); });
+  }
+
+  return Changed;
+}
+
 PreservedAnalyses LoopInvariantCodeMotion::run(Loop &L, LoopAnalysisManager &LAM,
                                 LoopStandardAnalysisResults &LAR,
                                 LPMUpdater &LU) {
 
+  OptimizationRemarkEmitter ORE(L.getHeader()->getParent());
+
   if (!L.isLoopSimplifyForm()) {
-    outs() << "\nIl loop non è in forma NORMALE.\n";
+    NumNotSimplified++;
+    ORE.emit([&]() {
+      return OptimizationRemarkMissed(DEBUG_TYPE, "NotLoopSimplifyForm",
+                                      L.getStartLoc(), L.getHeader())
+             << "loop not in simplify form";
+    });
     return PreservedAnalyses::all();
   }
 
-  outs() << "\nIl loop è in forma NORMALE, procediamo.\n";
-
-  BasicBlock *PreHeader = L.getLoopPreheader(); // Pre header
-  Instruction &FinalInst = PreHeader->back(); // Branch del pre header
-
-  std::set<BasicBlock *> LoopExitBB;
-  std::set<Instruction *> InstructionsLICM;
-
-  outs() << "********** LOOP **********\n";
-  for (auto BI = L.block_begin(); BI != L.block_end(); ++BI) {
-    BasicBlock *BB = *BI;
-
-    // Trovo tutti gli Exit Basic Blocks 
-    // (successori di dei blocchi del Loop che non appartengono al loop)
-    for (BasicBlock *Succ : successors(BB))
-      if (!L.contains(Succ))
-        LoopExitBB.insert(BB);
-
-
-    // Trovo tutte le Loop Invariant instructions
-    for (auto II = BB->begin(); II != BB->end(); II++) {
-      Instruction &Inst = *II;
-
-      // Controllo tutte le condizioni affinchè possa avvenire la code motion. 
-      
-      // Controllo se l'istruzione è loop invariant. 
-      if (isInstructionLoopInvariant(Inst, L)){
-        outs() << "LOOP INVARIANT -> ";
-        Inst.print(outs());
-        // Controllo che si trovi in un blocco che domina tutte le uscite
-        if (dominatesAllExits(Inst, LoopExitBB, LAR.DT)){
-          InstructionsLICM.insert(&Inst);
-          outs() << "\t[ DOMINA LE USCITE ]";
-        }
-        // OPPURE
-        // Controllo che non abbia usi dopo il loop.
-        if (isLoopDead(Inst, L)) {
-          InstructionsLICM.insert(&Inst);
-          outs() << "\t[ DEAD LOOP ]";
-        }
-
-        outs() << "\n";
-      } 
-    }
-  }
+  // MemorySSA è disponibile solo se il passo gira in loop-mssa(...): in quel
+  // caso va mantenuta aggiornata durante la code motion.
+  std::unique_ptr<MemorySSAUpdater> MSSAU;
+  if (LAR.MSSA)
+    MSSAU = std::make_unique<MemorySSAUpdater>(LAR.MSSA);
+
+  // Le frequenze dei blocchi (per la hoisting speculativa), stimate o da profilo, sono
+  // disponibili solo se il loop adaptor è stato creato con UseBlockFrequencyInfo, come
+  // in my-licm-bfi e nelle pipeline di my-loop-opt: un loop pass non può calcolarle e
+  // non può usare quelle della function, che non sono preservate durante le loop pass.
+  // Con -passes='loop-mssa(my-licm)' si usa quindi il criterio classico (isLoopDead).
+  BlockFrequencyInfo *BFI = LAR.BFI;
 
-  // Code motion
+  // Trovo tutte le Loop Invariant instructions e il loop più esterno del nest
+  // da cui possono essere spostate.
+  LoopChain Nest = getLoopChain(L);
+  HoistLevels Levels;
+  SmallVector<Instruction *, 16> InstructionsLICM;
+  computeHoistLevels(L, Nest, LAR, BFI, ORE, Levels, InstructionsLICM);
+  limitRegisterPressure(L, LAR, BFI, Levels, ORE, InstructionsLICM);
+
+  // Code motion: ogni istruzione va in fondo al preheader del suo loop di destinazione. 
   for (Instruction *Inst : InstructionsLICM) {
-    Inst->removeFromParent();
-    Inst->insertBefore(&FinalInst);
+    int Level = Levels[Inst];
+    BasicBlock *PreHeader = Nest[Level]->getLoopPreheader();
+
+    ORE.emit([&]() {
+      OptimizationRemark R(DEBUG_TYPE, "Hoisted", Inst);
+      R << "hoisting " << ore::NV("Inst", Inst);
+      if (Level > 0)
+        R << " out of " << ore::NV("Loops", Level + 1) << " nested loops";
+      return R;
+    });
+    Inst->moveBefore(PreHeader->getTerminator());
+    if (MSSAU)
+      if (MemoryUseOrDef *MA = LAR.MSSA->getMemoryAccess(Inst))
+        MSSAU->moveToPlace(MA, PreHeader, MemorySSA::BeforeTerminator);
+    NumHoisted++;
   }
 
+  bool Changed = !InstructionsLICM.empty();
+  Changed |= sinkToExitBlocks(L, LAR, ORE);
+  Changed |= promoteLoopAccesses(L, LAR, MSSAU.get(), ORE);
+
+  if (!Changed)
+    return PreservedAnalyses::all();
+
+  if (LAR.MSSA and VerifyMemorySSA)
+    LAR.MSSA->verifyMemorySSA();
+
+  // I valori spostati cambiano la loop disposition calcolata da SCEV.
+  LAR.SE.forgetLoopDispositions();
 
-  return PreservedAnalyses::all();
+  auto PA = getLoopPassPreservedAnalyses();
+  if (LAR.MSSA)
+    PA.preserve<MemorySSAAnalysis>();
+  return PA;
 }
\ No newline at end of file
@@ -0,0 +1,57 @@
+; RUN: opt -passes=localopts -S < %s | FileCheck %s
+
+; Algebraic identity e multi inst optimization su catene di add/sub per costanti,
+; anche vettoriali: gli offset vengono sommati lane per lane.
+
+define i32 @scalar_chain(i32 %b) {
+; CHECK-LABEL: @scalar_chain(
+; CHECK-NEXT:    ret i32 %b
+;
+  %a = add i32 %b, 3
+  %c = add i32 5, %a
+  %d = sub i32 %c, 8
+  ret i32 %d
+}
+
+; Costanti non splat: ogni lane torna al valore di partenza.
+define <2 x i32> @vector_chain(<2 x i32> %b) {
+; CHECK-LABEL: @vector_chain(
+; CHECK-NEXT:    ret <2 x i32> %b
+;
+  %a = add <2 x i32> %b, <i32 1, i32 2>
+  %c = sub <2 x i32> %a, <i32 1, i32 2>
+  ret <2 x i32> %c
+}
+
+; Solo alcune lane si annullano: la catena diventa una sola add.
+define <2 x i32> @vector_partial(<2 x i32> %b) {
+; CHECK-LABEL: @vector_partial(
+; CHECK-NEXT:    [[R:%.*]] = add <2 x i32> %b, <i32 5, i32 0>
+; CHECK-NEXT:    ret <2 x i32> [[R]]
+;
+  %a = add <2 x i32> %b, <i32 1, i32 2>
+  %c = add <2 x i32> %a, <i32 4, i32 -2>
+  ret <2 x i32> %c
+}
+
+; Le lane undef/poison possono valere 1 (mul) o 0 (add).
+define <2 x i32> @vector_identity(<2 x i32> %b) {
+; CHECK-LABEL: @vector_identity(
+; CHECK-NEXT:    ret <2 x i32> %b
+;
+  %a = mul <2 x i32> %b, <i32 1, i32 undef>
+  %c = add <2 x i32> %a, <i32 poison, i32 0>
+  ret <2 x i32> %c
+}
+
+; Un offset con una lane undef non è una costante nota e la catena resta.
+define <2 x i32> @vector_undef_offset(<2 x i32> %b) {
+; CHECK-LABEL: @vector_undef_offset(
+; CHECK-NEXT:    [[A:%.*]] = add <2 x i32> %b, <i32 1, i32 undef>
+; CHECK-NEXT:    [[C:%.*]] = sub <2 x i32> [[A]], <i32 1, i32 2>
+; CHECK-NEXT:    ret <2 x i32> [[C]]
+;
+  %a = add <2 x i32> %b, <i32 1, i32 undef>
+  %c = sub <2 x i32> %a, <i32 1, i32 2>
+  ret <2 x i32> %c
+}
@@ -0,0 +1,126 @@
+; RUN: opt -passes=localopts -S < %s | FileCheck %s
+
+; Divisioni e resti per costante: multiply-high con magic number e shift
+; (unsigned), oppure con correzione del segno (signed).
+
+define i32 @udiv_7(i32 %x) {
+; CHECK-LABEL: @udiv_7(
+; CHECK-NEXT:    [[EXT:%.*]] = zext i32 %x to i64
+; CHECK-NEXT:    [[MUL:%.*]] = mul i64 [[EXT]], 613566757
+; CHECK-NEXT:    [[HI:%.*]] = lshr i64 [[MUL]], 32
+; CHECK-NEXT:    [[Q:%.*]] = trunc i64 [[HI]] to i32
+; CHECK-NEXT:    [[SUB:%.*]] = sub i32 %x, [[Q]]
+; CHECK-NEXT:    [[HALF:%.*]] = lshr i32 [[SUB]], 1
+; CHECK-NEXT:    [[ADD:%.*]] = add i32 [[HALF]], [[Q]]
+; CHECK-NEXT:    [[RES:%.*]] = lshr i32 [[ADD]], 2
+; CHECK-NEXT:    ret i32 [[RES]]
+;
+  %r = udiv i32 %x, 7
+  ret i32 %r
+}
+
+define i32 @udiv_8(i32 %x) {
+; CHECK-LABEL: @udiv_8(
+; CHECK-NEXT:    [[RES:%.*]] = lshr i32 %x, 3
+; CHECK-NEXT:    ret i32 [[RES]]
+;
+  %r = udiv i32 %x, 8
+  ret i32 %r
+}
+
+define i64 @udiv_10_i64(i64 %x) {
+; CHECK-LABEL: @udiv_10_i64(
+; CHECK-NEXT:    [[EXT:%.*]] = zext i64 %x to i128
+; CHECK-NEXT:    [[MUL:%.*]] = mul i128 [[EXT]], 14757395258967641293
+; CHECK-NEXT:    [[HI:%.*]] = lshr i128 [[MUL]], 64
+; CHECK-NEXT:    [[Q:%.*]] = trunc i128 [[HI]] to i64
+; CHECK-NEXT:    [[RES:%.*]] = lshr i64 [[Q]], 3
+; CHECK-NEXT:    ret i64 [[RES]]
+;
+  %r = udiv i64 %x, 10
+  ret i64 %r
+}
+
+define i32 @urem_10(i32 %x) {
+; CHECK-LABEL: @urem_10(
+; CHECK-NEXT:    [[EXT:%.*]] = zext i32 %x to i64
+; CHECK-NEXT:    [[MUL:%.*]] = mul i64 [[EXT]], 3435973837
+; CHECK-NEXT:    [[HI:%.*]] = lshr i64 [[MUL]], 32
+; CHECK-NEXT:    [[T:%.*]] = trunc i64 [[HI]] to i32
+; CHECK-NEXT:    [[Q:%.*]] = lshr i32 [[T]], 3
+; CHECK-NEXT:    [[QD:%.*]] = mul i32 [[Q]], 10
+; CHECK-NEXT:    [[RES:%.*]] = sub i32 %x, [[QD]]
+; CHECK-NEXT:    ret i32 [[RES]]
+;
+  %r = urem i32 %x, 10
+  ret i32 %r
+}
+
+; Con un dividendo negativo lo shift aritmetico arrotonda verso -inf: il bias
+; (divisore - 1, solo se x < 0) lo fa arrotondare verso 0 come sdiv.
+define i32 @sdiv_8(i32 %x) {
+; CHECK-LABEL: @sdiv_8(
+; CHECK-NEXT:    [[SIGN:%.*]] = ashr i32 %x, 31
+; CHECK-NEXT:    [[BIAS:%.*]] = lshr i32 [[SIGN]], 29
+; CHECK-NEXT:    [[ADD:%.*]] = add i32 %x, [[BIAS]]
+; CHECK-NEXT:    [[RES:%.*]] = ashr i32 [[ADD]], 3
+; CHECK-NEXT:    ret i32 [[RES]]
+;
+  %r = sdiv i32 %x, 8
+  ret i32 %r
+}
+
+define i32 @sdiv_7(i32 %x) {
+; CHECK-LABEL: @sdiv_7(
+; CHECK-NEXT:    [[EXT:%.*]] = sext i32 %x to i64
+; CHECK-NEXT:    [[MUL:%.*]] = mul i64 [[EXT]], -1840700269
+; CHECK-NEXT:    [[HI:%.*]] = lshr i64 [[MUL]], 32
+; CHECK-NEXT:    [[T:%.*]] = trunc i64 [[HI]] to i32
+; CHECK-NEXT:    [[ADD:%.*]] = add i32 [[T]], %x
+; CHECK-NEXT:    [[Q:%.*]] = ashr i32 [[ADD]], 2
+; CHECK-NEXT:    [[SIGN:%.*]] = lshr i32 [[Q]], 31
+; CHECK-NEXT:    [[RES:%.*]] = add i32 [[Q]], [[SIGN]]
+; CHECK-NEXT:    ret i32 [[RES]]
+;
+  %r = sdiv i32 %x, 7
+  ret i32 %r
+}
+
+define i32 @sdiv_minus_7(i32 %x) {
+; CHECK-LABEL: @sdiv_minus_7(
+; CHECK-NEXT:    [[EXT:%.*]] = sext i32 %x to i64
+; CHECK-NEXT:    [[MUL:%.*]] = mul i64 [[EXT]], 1840700269
+; CHECK-NEXT:    [[HI:%.*]] = lshr i64 [[MUL]], 32
+; CHECK-NEXT:    [[T:%.*]] = trunc i64 [[HI]] to i32
+; CHECK-NEXT:    [[SUB:%.*]] = sub i32 [[T]], %x
+; CHECK-NEXT:    [[Q:%.*]] = ashr i32 [[SUB]], 2
+; CHECK-NEXT:    [[SIGN:%.*]] = lshr i32 [[Q]], 31
+; CHECK-NEXT:    [[RES:%.*]] = add i32 [[Q]], [[SIGN]]
+; CHECK-NEXT:    ret i32 [[RES]]
+;
+  %r = sdiv i32 %x, -7
+  ret i32 %r
+}
+
+define i32 @srem_7(i32 %x) {
+; CHECK-LABEL: @srem_7(
+; CHECK:         mul i64 {{%.*}}, -1840700269
+; CHECK:         [[SIGN:%.*]] = lshr i32 [[Q0:%.*]], 31
+; CHECK-NEXT:    [[Q:%.*]] = add i32 [[Q0]], [[SIGN]]
+; CHECK-NEXT:    [[QD:%.*]] = mul i32 [[Q]], 7
+; CHECK-NEXT:    [[RES:%.*]] = sub i32 %x, [[QD]]
+; CHECK-NEXT:    ret i32 [[RES]]
+;
+  %r = srem i32 %x, 7
+  ret i32 %r
+}
+
+; Il divisore non è una costante: la divisione resta.
+define i32 @udiv_variable(i32 %x, i32 %y) {
+; CHECK-LABEL: @udiv_variable(
+; CHECK-NEXT:    [[R:%.*]] = udiv i32 %x, %y
+; CHECK-NEXT:    ret i32 [[R]]
+;
+  %r = udiv i32 %x, %y
+  ret i32 %r
+}
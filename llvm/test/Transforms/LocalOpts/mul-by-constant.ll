@@ -0,0 +1,77 @@
+; RUN: opt -passes=localopts -localopts-mul-latency=4 -S < %s | FileCheck %s --check-prefixes=CHECK,LAT4
+; RUN: opt -passes=localopts -localopts-mul-latency=5 -S < %s | FileCheck %s --check-prefixes=CHECK,LAT5
+; RUN: opt -passes=localopts -localopts-mul-latency=4 -pass-remarks-missed=localopts \
+; RUN:     -disable-output < %s 2>&1 | FileCheck %s --check-prefix=REMARK
+
+; Moltiplicazioni per costante: la sequenza di shift/add/sub (forma CSD oppure
+; prodotto di fattori) sostituisce la mul solo se è più veloce della mul nativa.
+
+; 15 = 16 - 1
+define i32 @mul_15(i32 %x) {
+; CHECK-LABEL: @mul_15(
+; CHECK-NEXT:    [[SHL:%.*]] = shl i32 %x, 4
+; CHECK-NEXT:    [[RES:%.*]] = sub i32 [[SHL]], %x
+; CHECK-NEXT:    ret i32 [[RES]]
+;
+  %r = mul i32 %x, 15
+  ret i32 %r
+}
+
+; 10 = 2 + 8
+define i32 @mul_10(i32 %x) {
+; CHECK-LABEL: @mul_10(
+; CHECK-NEXT:    [[SHL1:%.*]] = shl i32 %x, 1
+; CHECK-NEXT:    [[SHL3:%.*]] = shl i32 %x, 3
+; CHECK-NEXT:    [[RES:%.*]] = add i32 [[SHL1]], [[SHL3]]
+; CHECK-NEXT:    ret i32 [[RES]]
+;
+  %r = mul i32 %x, 10
+  ret i32 %r
+}
+
+define i32 @mul_minus_8(i32 %x) {
+; CHECK-LABEL: @mul_minus_8(
+; CHECK-NEXT:    [[SHL:%.*]] = shl i32 %x, 3
+; CHECK-NEXT:    [[RES:%.*]] = sub i32 0, [[SHL]]
+; CHECK-NEXT:    ret i32 [[RES]]
+;
+  %r = mul i32 %x, -8
+  ret i32 %r
+}
+
+; 45 = 3 * 15: la forma a fattori richiede 4 istruzioni in sequenza, conviene
+; solo se la mul costa almeno 5 cicli.
+define i32 @mul_45(i32 %x) {
+; CHECK-LABEL: @mul_45(
+; LAT4-NEXT:     [[RES:%.*]] = mul i32 %x, 45
+; LAT5-NEXT:     [[SHL2:%.*]] = shl i32 %x, 2
+; LAT5-NEXT:     [[X3:%.*]] = sub i32 [[SHL2]], %x
+; LAT5-NEXT:     [[SHL4:%.*]] = shl i32 [[X3]], 4
+; LAT5-NEXT:     [[RES:%.*]] = sub i32 [[SHL4]], [[X3]]
+; CHECK-NEXT:    ret i32 [[RES]]
+;
+  %r = mul i32 %x, 45
+  ret i32 %r
+}
+
+define i32 @mul_12345(i32 %x) {
+; CHECK-LABEL: @mul_12345(
+; CHECK-NEXT:    [[RES:%.*]] = mul i32 %x, 12345
+; CHECK-NEXT:    ret i32 [[RES]]
+;
+  %r = mul i32 %x, 12345
+  ret i32 %r
+}
+
+; Ogni elemento del vettore è 1 + 2^k: una sola shl con shift diversi per elemento.
+define <4 x i32> @mul_vector(<4 x i32> %x) {
+; CHECK-LABEL: @mul_vector(
+; CHECK-NEXT:    [[SHL:%.*]] = shl <4 x i32> %x, <i32 1, i32 2, i32 3, i32 4>
+; CHECK-NEXT:    [[RES:%.*]] = add <4 x i32> %x, [[SHL]]
+; CHECK-NEXT:    ret <4 x i32> [[RES]]
+;
+  %r = mul <4 x i32> %x, <i32 3, i32 5, i32 9, i32 17>
+  ret <4 x i32> %r
+}
+
+; REMARK: multiply by 12345 kept: shift/add sequence of 8 instructions is not cheaper than the native multiply
@@ -0,0 +1,116 @@
+; RUN: opt -passes='loop-mssa(my-iv-sr)' -S < %s | FileCheck %s
+; RUN: opt -passes='loop-mssa(my-iv-sr)' -pass-remarks=my-iv-sr -disable-output < %s 2>&1 \
+; RUN:     | FileCheck %s --check-prefix=REMARK
+
+; Strength reduction delle induction variable: un'espressione affine dell'IV viene
+; sostituita da una nuova IV incrementata del passo ad ogni iterazione.
+
+; REMARK: replaced mul with an induction variable
+; REMARK-NEXT: replaced add with an induction variable
+; REMARK-NEXT: replaced shl with an induction variable
+; REMARK-NEXT: replaced mul with an induction variable
+; REMARK-NOT: replaced
+
+; Il passo è un argomento, quindi loop invariant: i * s diventa una IV incrementata
+; di s ad ogni iterazione.
+define void @stride(ptr %a, i32 %s, i32 %n) {
+; CHECK-LABEL: @stride(
+; CHECK:       loop:
+; CHECK-NEXT:    [[IV:%.*]] = phi i32 [ 0, %entry ], [ [[IV_NEXT:%.*]], %loop ]
+; CHECK-NOT:     mul
+; CHECK:         [[P:%.*]] = getelementptr inbounds i32, ptr %a, i32 [[IV]]
+; CHECK:         [[IV_NEXT]] = add i32 [[IV]], %s
+;
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %idx = mul i32 %i, %s
+  %p = getelementptr inbounds i32, ptr %a, i32 %idx
+  store i32 %i, ptr %p, align 4
+  %i.next = add nuw nsw i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; 12 * i + 5: la mul e la add vengono sostituite da una sola IV che parte da 5.
+define void @affine(ptr %a, i32 %n) {
+; CHECK-LABEL: @affine(
+; CHECK:       loop:
+; CHECK-NEXT:    [[IV:%.*]] = phi i32 [ 5, %entry ], [ [[IV_NEXT:%.*]], %loop ]
+; CHECK-NOT:     mul
+; CHECK:         store i32 [[IV]], ptr
+; CHECK:         [[IV_NEXT]] = add i32 [[IV]], 12
+;
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %m = mul i32 %i, 12
+  %v = add i32 %m, 5
+  %p = getelementptr inbounds i32, ptr %a, i32 %i
+  store i32 %v, ptr %p, align 4
+  %i.next = add nuw nsw i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; i << 2 e i * 4 calcolano la stessa espressione e condividono la stessa IV.
+define void @shared(ptr %a, ptr %b, i32 %n) {
+; CHECK-LABEL: @shared(
+; CHECK:       loop:
+; CHECK-NEXT:    [[IV:%.*]] = phi i32 [ 0, %entry ], [ [[IV_NEXT:%.*]], %loop ]
+; CHECK-NEXT:    %i = phi i32
+; CHECK-NEXT:    getelementptr inbounds i32, ptr %a, i32 [[IV]]
+; CHECK:         getelementptr inbounds i32, ptr %b, i32 [[IV]]
+; CHECK:         [[IV_NEXT]] = add i32 [[IV]], 4
+;
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %x = shl i32 %i, 2
+  %y = mul i32 %i, 4
+  %pa = getelementptr inbounds i32, ptr %a, i32 %x
+  store i32 %i, ptr %pa, align 4
+  %pb = getelementptr inbounds i32, ptr %b, i32 %y
+  store i32 %i, ptr %pb, align 4
+  %i.next = add nuw nsw i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; i * i non è affine: la mul resta nel loop.
+define void @not_affine(ptr %a, i32 %n) {
+; CHECK-LABEL: @not_affine(
+; CHECK:       loop:
+; CHECK-NEXT:    %i = phi i32
+; CHECK-NEXT:    %sq = mul i32 %i, %i
+;
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %sq = mul i32 %i, %i
+  %p = getelementptr inbounds i32, ptr %a, i32 %i
+  store i32 %sq, ptr %p, align 4
+  %i.next = add nuw nsw i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret void
+}
@@ -0,0 +1,56 @@
+; RUN: opt -passes='loop-mssa(my-licm)' -aa-pipeline=basic-aa -S < %s | FileCheck %s
+; RUN: opt -passes='loop-mssa(my-licm)' -aa-pipeline=basic-aa -pass-remarks=my-licm \
+; RUN:     -disable-output < %s 2>&1 | FileCheck %s --check-prefix=REMARK
+
+; Hoisting in un loop nest: ogni invariante va direttamente nel preheader del loop
+; più esterno in cui è ancora invariante.
+
+; REMARK: hoisting mul out of 2 nested loops
+; REMARK-NEXT: hoisting mul
+; REMARK-NEXT: hoisting add
+; REMARK-NOT: hoisting
+
+; %kk è invariante in tutto il nest, %row e %v solo nel loop interno (dipendono da %i).
+define void @nest(ptr %a, i32 %k, i32 %n) {
+; CHECK-LABEL: @nest(
+; CHECK:       entry:
+; CHECK-NEXT:    [[KK:%.*]] = mul i32 %k, 3
+; CHECK-NEXT:    br label %outer
+; CHECK:       outer:
+; CHECK-NEXT:    [[I:%.*]] = phi i32
+; CHECK-NEXT:    [[ROW:%.*]] = mul i32 [[I]], %n
+; CHECK-NEXT:    [[V:%.*]] = add i32 [[KK]], [[ROW]]
+; CHECK-NEXT:    br label %inner
+; CHECK:       inner:
+; CHECK-NEXT:    [[J:%.*]] = phi i32
+; CHECK-NEXT:    add i32 [[ROW]], [[J]]
+; CHECK-NOT:     mul
+; CHECK:         store i32 [[V]]
+;
+entry:
+  br label %outer
+
+outer:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %outer.latch ]
+  br label %inner
+
+inner:
+  %j = phi i32 [ 0, %outer ], [ %j.next, %inner ]
+  %kk = mul i32 %k, 3
+  %row = mul i32 %i, %n
+  %off = add i32 %row, %j
+  %v = add i32 %kk, %row
+  %p = getelementptr inbounds i32, ptr %a, i32 %off
+  store i32 %v, ptr %p, align 4
+  %j.next = add nuw nsw i32 %j, 1
+  %cj = icmp slt i32 %j.next, %n
+  br i1 %cj, label %inner, label %outer.latch
+
+outer.latch:
+  %i.next = add nuw nsw i32 %i, 1
+  %ci = icmp slt i32 %i.next, %n
+  br i1 %ci, label %outer, label %exit
+
+exit:
+  ret void
+}
@@ -0,0 +1,53 @@
+; RUN: opt -passes='loop-mssa(my-licm)' -aa-pipeline=basic-aa -S < %s | FileCheck %s
+; RUN: opt -passes='loop-mssa(my-licm)' -aa-pipeline=basic-aa -pass-remarks=my-licm \
+; RUN:     -pass-remarks-missed=my-licm -disable-output < %s 2>&1 | FileCheck %s --check-prefix=REMARK
+
+; Limite sulla pressione dei registri: ogni invariante spostato nel preheader resta
+; vivo per tutto il loop. Senza target triple il TTI di default ha 8 registri e
+; il loop ne occupa già 4 (%i, %a, %k, %n), quindi solo quattro delle sei mul
+; vengono spostate; le altre restano nel loop e vengono ricalcolate.
+
+; REMARK: invariant instruction not hoisted: not enough registers to keep it live across the loop, it is cheap to rematerialize in the loop
+; REMARK-NEXT: invariant instruction not hoisted: not enough registers to keep it live across the loop, it is cheap to rematerialize in the loop
+; REMARK-COUNT-4: hoisting mul
+; REMARK-NOT: hoisting
+
+define void @pressure(ptr %a, i32 %k, i32 %n) {
+; CHECK-LABEL: @pressure(
+; CHECK:       entry:
+; CHECK-NEXT:    mul i32 %k, 3
+; CHECK-NEXT:    mul i32 %k, 5
+; CHECK-NEXT:    mul i32 %k, 7
+; CHECK-NEXT:    mul i32 %k, 9
+; CHECK-NEXT:    br label %loop
+; CHECK:       loop:
+; CHECK:         mul i32 %k, 11
+; CHECK-NEXT:    mul i32 %k, 13
+;
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %p = getelementptr inbounds i32, ptr %a, i32 %i
+  %x = load i32, ptr %p, align 4
+  %k1 = mul i32 %k, 3
+  %k2 = mul i32 %k, 5
+  %k3 = mul i32 %k, 7
+  %k4 = mul i32 %k, 9
+  %k5 = mul i32 %k, 11
+  %k6 = mul i32 %k, 13
+  %x1 = xor i32 %x, %k1
+  %x2 = add i32 %x1, %k2
+  %x3 = xor i32 %x2, %k3
+  %x4 = add i32 %x3, %k4
+  %x5 = xor i32 %x4, %k5
+  %x6 = add i32 %x5, %k6
+  store i32 %x6, ptr %p, align 4
+  %i.next = add nuw nsw i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret void
+}
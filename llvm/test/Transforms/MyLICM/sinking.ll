@@ -0,0 +1,66 @@
+; RUN: opt -passes='loop-mssa(my-licm)' -aa-pipeline=basic-aa -S < %s | FileCheck %s
+; RUN: opt -passes='loop-mssa(my-licm)' -aa-pipeline=basic-aa -pass-remarks=my-licm \
+; RUN:     -disable-output < %s 2>&1 | FileCheck %s --check-prefix=REMARK
+
+; Sinking: le istruzioni calcolate ad ogni iterazione ma usate solo dopo il loop
+; vengono ricalcolate una volta nell'exit block, con i valori dell'ultima iterazione.
+
+; REMARK: sinking add
+; REMARK-NEXT: sinking mul
+; REMARK-NOT: sinking
+
+; La add usa la mul, che quindi viene affondata insieme a lei.
+define i32 @sink(ptr %a, i32 %k, i32 %n) {
+; CHECK-LABEL: @sink(
+; CHECK:       loop:
+; CHECK-NOT:     mul
+; CHECK:       exit:
+; CHECK-NEXT:    [[I:%.*]] = phi i32 [ %i, %loop ]
+; CHECK-NEXT:    [[X:%.*]] = mul i32 [[I]], %k
+; CHECK-NEXT:    [[Y:%.*]] = add i32 [[X]], 1
+; CHECK-NEXT:    ret i32 [[Y]]
+;
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %p = getelementptr inbounds i32, ptr %a, i32 %i
+  store i32 %i, ptr %p, align 4
+  %x = mul i32 %i, %k
+  %y = add i32 %x, 1
+  %i.next = add nuw nsw i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  %y.lcssa = phi i32 [ %y, %loop ]
+  ret i32 %y.lcssa
+}
+
+; Una load non viene affondata: il loop scrive in memoria e dopo l'ultima
+; iterazione potrebbe leggere un valore diverso.
+define i32 @no_sink_load(ptr %a, i32 %n) {
+; CHECK-LABEL: @no_sink_load(
+; CHECK:       loop:
+; CHECK:         [[V:%.*]] = load i32, ptr {{%.*}}, align 4
+; CHECK:       exit:
+; CHECK-NEXT:    [[LCSSA:%.*]] = phi i32 [ [[V]], %loop ]
+; CHECK-NEXT:    ret i32 [[LCSSA]]
+;
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %p = getelementptr inbounds i32, ptr %a, i32 %i
+  %v = load i32, ptr %p, align 4
+  store i32 %i, ptr %a, align 4
+  %i.next = add nuw nsw i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  %v.lcssa = phi i32 [ %v, %loop ]
+  ret i32 %v.lcssa
+}
@@ -0,0 +1,85 @@
+; RUN: opt -passes=my-licm-bfi -aa-pipeline=basic-aa -S < %s | FileCheck %s
+; RUN: opt -passes=my-licm-bfi -aa-pipeline=basic-aa -pass-remarks=my-licm \
+; RUN:     -pass-remarks-missed=my-licm -disable-output < %s 2>&1 | FileCheck %s --check-prefix=REMARK
+
+; Hoisting speculativa guidata dalle frequenze dei blocchi (my-licm-bfi): un invariante
+; in un ramo condizionale va nel preheader solo se il ramo viene eseguito almeno
+; quanto il preheader. Il loop adaptor calcola le frequenze solo per le function
+; con un profilo, quindi entrambe hanno function_entry_count.
+
+; REMARK: hoisting mul
+; REMARK-NEXT: invariant instruction not hoisted: its block does not run often enough relative to the preheader
+
+; Il ramo viene preso quasi ad ogni iterazione.
+define void @hot(ptr %a, i32 %k, i32 %n) !prof !0 {
+; CHECK-LABEL: @hot(
+; CHECK:       entry:
+; CHECK-NEXT:    [[KK:%.*]] = mul i32 %k, %k
+; CHECK:       then:
+; CHECK-NEXT:    add i32 {{%.*}}, [[KK]]
+;
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %latch ]
+  %p = getelementptr inbounds i32, ptr %a, i32 %i
+  %v = load i32, ptr %p, align 4
+  %odd = and i32 %v, 1
+  %c = icmp ne i32 %odd, 0
+  br i1 %c, label %then, label %latch, !prof !1
+
+then:
+  %kk = mul i32 %k, %k
+  %w = add i32 %v, %kk
+  store i32 %w, ptr %p, align 4
+  br label %latch
+
+latch:
+  %i.next = add nuw nsw i32 %i, 1
+  %cl = icmp slt i32 %i.next, %n
+  br i1 %cl, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; Il ramo viene preso una volta ogni 100 iterazioni: spostare la mul nel preheader
+; la eseguirebbe più spesso di quanto faccia il loop.
+define void @cold(ptr %a, i32 %k, i32 %n) !prof !0 {
+; CHECK-LABEL: @cold(
+; CHECK:       entry:
+; CHECK-NEXT:    br label %loop
+; CHECK:       then:
+; CHECK-NEXT:    [[KK:%.*]] = mul i32 %k, %k
+; CHECK-NEXT:    add i32 {{%.*}}, [[KK]]
+;
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %latch ]
+  %p = getelementptr inbounds i32, ptr %a, i32 %i
+  %v = load i32, ptr %p, align 4
+  %odd = and i32 %v, 1
+  %c = icmp ne i32 %odd, 0
+  br i1 %c, label %then, label %latch, !prof !2
+
+then:
+  %kk = mul i32 %k, %k
+  %w = add i32 %v, %kk
+  store i32 %w, ptr %p, align 4
+  br label %latch
+
+latch:
+  %i.next = add nuw nsw i32 %i, 1
+  %cl = icmp slt i32 %i.next, %n
+  br i1 %cl, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+!0 = !{!"function_entry_count", i64 1000}
+!1 = !{!"branch_weights", i32 100, i32 1}
+!2 = !{!"branch_weights", i32 1, i32 100}
@@ -0,0 +1,101 @@
+; RUN: opt -passes='loop-mssa(my-licm)' -aa-pipeline=basic-aa -S < %s | FileCheck %s
+; RUN: opt -passes='loop-mssa(my-licm)' -aa-pipeline=basic-aa -pass-remarks-missed=my-licm \
+; RUN:     -disable-output < %s 2>&1 | FileCheck %s --check-prefix=REMARK
+
+; Promozione in registro delle locazioni lette e scritte ad ogni iterazione: la
+; load va nel preheader e la store negli exit block.
+
+declare void @may_throw() inaccessiblememonly
+
+define void @promote(ptr %p, i32 %n) {
+; CHECK-LABEL: @promote(
+; CHECK:       entry:
+; CHECK-NEXT:    [[INIT:%.*]] = load i32, ptr %p
+; CHECK:       loop:
+; CHECK-NEXT:    [[V:%.*]] = phi i32 [ [[INIT]], %entry ], [ [[ADD:%.*]], %loop ]
+; CHECK-NOT:     load
+; CHECK-NOT:     store
+; CHECK:       exit:
+; CHECK-NEXT:    [[LCSSA:%.*]] = phi i32 [ [[ADD]], %loop ]
+; CHECK-NEXT:    store i32 [[LCSSA]], ptr %p
+;
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %v = load i32, ptr %p
+  %add = add i32 %v, %i
+  store i32 %add, ptr %p
+  %i.next = add i32 %i, 1
+  %cond = icmp slt i32 %i.next, %n
+  br i1 %cond, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; La call può lanciare un'eccezione: il chiamante vedrebbe in *p il valore
+; dell'ultima iterazione completata, quindi la store resta nel loop.
+define void @no_promote_may_throw(ptr noalias %p, i32 %n) {
+; CHECK-LABEL: @no_promote_may_throw(
+; CHECK:       loop:
+; CHECK:         [[V:%.*]] = load i32, ptr %p
+; CHECK:         store i32 {{%.*}}, ptr %p
+; CHECK:         call void @may_throw()
+; CHECK:       exit:
+; CHECK-NEXT:    ret void
+;
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %v = load i32, ptr %p
+  %add = add i32 %v, %i
+  store i32 %add, ptr %p
+  call void @may_throw()
+  %i.next = add i32 %i, 1
+  %cond = icmp slt i32 %i.next, %n
+  br i1 %cond, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; Un alloca che non sfugge alla function non è visibile dopo un'eccezione:
+; la promozione è possibile anche se il loop può lanciare.
+define i32 @promote_local_may_throw(i32 %n) {
+; CHECK-LABEL: @promote_local_may_throw(
+; CHECK:       entry:
+; CHECK:         [[INIT:%.*]] = load i32, ptr %a
+; CHECK:       loop:
+; CHECK-NEXT:    [[V:%.*]] = phi i32 [ [[INIT]], %entry ], [ [[ADD:%.*]], %loop ]
+; CHECK-NOT:     load
+; CHECK-NOT:     store
+; CHECK:       exit:
+; CHECK-NEXT:    [[LCSSA:%.*]] = phi i32 [ [[ADD]], %loop ]
+; CHECK-NEXT:    store i32 [[LCSSA]], ptr %a
+;
+entry:
+  %a = alloca i32
+  store i32 0, ptr %a
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %v = load i32, ptr %a
+  %add = add i32 %v, %i
+  store i32 %add, ptr %a
+  call void @may_throw()
+  %i.next = add i32 %i, 1
+  %cond = icmp slt i32 %i.next, %n
+  br i1 %cond, label %loop, label %exit
+
+exit:
+  %r = load i32, ptr %a
+  ret i32 %r
+}
+
+; REMARK: not promoting memory location: the loop may exit without reaching the exit blocks
+; REMARK-NOT: not promoting memory location
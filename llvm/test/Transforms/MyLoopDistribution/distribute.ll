@@ -0,0 +1,81 @@
+; RUN: opt -passes=my-loop-distribution -aa-pipeline=basic-aa -S < %s | FileCheck %s
+; RUN: opt -passes=my-loop-distribution -aa-pipeline=basic-aa -pass-remarks=my-loop-distribution \
+; RUN:     -pass-remarks-missed=my-loop-distribution -disable-output < %s 2>&1 \
+; RUN:     | FileCheck %s --check-prefix=REMARK
+
+; Distribuzione di un loop interno: le store che non fanno parte di un ciclo di
+; dipendenze vengono eseguite da un loop separato.
+
+; REMARK: loop in loop distributed into 2 loops
+; REMARK-NEXT: loop in loop not distributed: all stores are in one dependence cycle
+
+; La ricorrenza c[i+1] = c[i] + a[i] non è vettorizzabile, mentre d[i] = e[i] << 1
+; lo è: ognuna viene eseguita da una copia del loop, nell'ordine del body.
+define void @split(ptr noalias %a, ptr noalias %c, ptr noalias %d, ptr noalias %e, i32 %n) {
+; CHECK-LABEL: @split(
+; CHECK:       loop.ldist:
+; CHECK:         [[SUM:%.*]] = add i32
+; CHECK-NEXT:    [[PC1:%.*]] = getelementptr inbounds i32, ptr %c, i32
+; CHECK-NEXT:    store i32 [[SUM]], ptr [[PC1]]
+; CHECK-NOT:     store
+; CHECK:         br i1 {{%.*}}, label %loop.ldist, label %entry.split
+; CHECK:       loop:
+; CHECK-NOT:     ptr %c
+; CHECK:         [[VE:%.*]] = load i32, ptr {{%.*}}
+; CHECK-NEXT:    [[DBL:%.*]] = shl i32 [[VE]], 1
+; CHECK-NEXT:    [[PD:%.*]] = getelementptr inbounds i32, ptr %d, i32 %i
+; CHECK-NEXT:    store i32 [[DBL]], ptr [[PD]]
+; CHECK:         br i1 {{%.*}}, label %loop, label %exit
+;
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %i.1 = add nuw nsw i32 %i, 1
+  %pc = getelementptr inbounds i32, ptr %c, i32 %i
+  %vc = load i32, ptr %pc, align 4
+  %pa = getelementptr inbounds i32, ptr %a, i32 %i
+  %va = load i32, ptr %pa, align 4
+  %sum = add i32 %vc, %va
+  %pc1 = getelementptr inbounds i32, ptr %c, i32 %i.1
+  store i32 %sum, ptr %pc1, align 4
+  %pe = getelementptr inbounds i32, ptr %e, i32 %i
+  %ve = load i32, ptr %pe, align 4
+  %dbl = shl i32 %ve, 1
+  %pd = getelementptr inbounds i32, ptr %d, i32 %i
+  store i32 %dbl, ptr %pd, align 4
+  %i.next = add nuw nsw i32 %i, 1
+  %cond = icmp slt i32 %i.next, %n
+  br i1 %cond, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; a[i] = b[i] e b[i+1] = a[i] formano un ciclo di dipendenze: il loop resta intero.
+define void @cycle(ptr noalias %a, ptr noalias %b, i32 %n) {
+; CHECK-LABEL: @cycle(
+; CHECK-NOT:   ldist
+; CHECK:       ret void
+;
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %i.1 = add nuw nsw i32 %i, 1
+  %pb = getelementptr inbounds i32, ptr %b, i32 %i
+  %vb = load i32, ptr %pb, align 4
+  %pa = getelementptr inbounds i32, ptr %a, i32 %i
+  store i32 %vb, ptr %pa, align 4
+  %va = load i32, ptr %pa, align 4
+  %pb1 = getelementptr inbounds i32, ptr %b, i32 %i.1
+  store i32 %va, ptr %pb1, align 4
+  %i.next = add nuw nsw i32 %i, 1
+  %cond = icmp slt i32 %i.next, %n
+  br i1 %cond, label %loop, label %exit
+
+exit:
+  ret void
+}
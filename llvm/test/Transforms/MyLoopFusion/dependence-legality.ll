@@ -0,0 +1,166 @@
+; RUN: opt -passes=my-loop-fusion -aa-pipeline=basic-aa -S < %s | FileCheck %s
+; RUN: opt -passes=my-loop-fusion -aa-pipeline=basic-aa -pass-remarks=my-loop-fusion \
+; RUN:     -pass-remarks-missed=my-loop-fusion -disable-output < %s 2>&1 | FileCheck %s --check-prefix=REMARK
+
+; Legalità della fusione: L2 all'iterazione j non può accedere a una locazione
+; scritta da L1 in un'iterazione successiva.
+
+; REMARK: loop in h1 fused with loop in h2
+; REMARK-NEXT: loop in h1 not fused with loop in h2: negative dependence distance
+; REMARK-NEXT: loop in h1 fused with loop in h2
+; REMARK-NEXT: loop in h1 not fused with loop in h2: second loop uses values computed in the first loop
+
+; L2 legge A[j] scritto da L1 nella stessa iterazione: il loop fuso non ha
+; dipendenze tra iterazioni diverse e viene annotato come parallelo.
+; CHECK-LABEL: @forward(
+; CHECK:       h1:
+; CHECK-NEXT:    [[I:%.*]] = phi i32
+; CHECK:         store i32 [[I]], ptr {{%.*}}, align 4, !llvm.access.group [[AG:![0-9]+]]
+; CHECK:         br label %h1, !llvm.loop [[LOOP:![0-9]+]]
+; CHECK:         [[LA:%.*]] = getelementptr inbounds i32, ptr %A, i32 [[I]]
+; CHECK-NEXT:    load i32, ptr [[LA]], align 4, !llvm.access.group [[AG]]
+; CHECK-NOT:   h2:
+; CHECK:       ret void
+define void @forward(ptr noalias %A, ptr noalias %B, i32 %n) {
+entry:
+  br label %h1
+h1:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %b1 ]
+  %c1 = icmp slt i32 %i, %n
+  br i1 %c1, label %b1, label %x1
+b1:
+  %pa = getelementptr inbounds i32, ptr %A, i32 %i
+  store i32 %i, ptr %pa
+  %i.next = add nsw i32 %i, 1
+  br label %h1
+x1:
+  br label %h2
+h2:
+  %j = phi i32 [ 0, %x1 ], [ %j.next, %b2 ]
+  %c2 = icmp slt i32 %j, %n
+  br i1 %c2, label %b2, label %x2
+b2:
+  %la = getelementptr inbounds i32, ptr %A, i32 %j
+  %v = load i32, ptr %la
+  %pb = getelementptr inbounds i32, ptr %B, i32 %j
+  store i32 %v, ptr %pb
+  %j.next = add nsw i32 %j, 1
+  br label %h2
+x2:
+  ret void
+}
+
+; L2 legge A[j+1], che L1 scrive all'iterazione successiva: dopo la fusione
+; la load leggerebbe il valore vecchio.
+; CHECK-LABEL: @negative_distance(
+; CHECK:       h1:
+; CHECK:       h2:
+; CHECK:       ret void
+define void @negative_distance(ptr noalias %A, ptr noalias %B, i32 %n) {
+entry:
+  br label %h1
+h1:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %b1 ]
+  %c1 = icmp slt i32 %i, %n
+  br i1 %c1, label %b1, label %x1
+b1:
+  %pa = getelementptr inbounds i32, ptr %A, i32 %i
+  store i32 %i, ptr %pa
+  %i.next = add nsw i32 %i, 1
+  br label %h1
+x1:
+  br label %h2
+h2:
+  %j = phi i32 [ 0, %x1 ], [ %j.next, %b2 ]
+  %c2 = icmp slt i32 %j, %n
+  br i1 %c2, label %b2, label %x2
+b2:
+  %j1 = add nsw i32 %j, 1
+  %la = getelementptr inbounds i32, ptr %A, i32 %j1
+  %v = load i32, ptr %la
+  %pb = getelementptr inbounds i32, ptr %B, i32 %j
+  store i32 %v, ptr %pb
+  %j.next = add nsw i32 %j, 1
+  br label %h2
+x2:
+  ret void
+}
+
+; L2 legge A[j-1], scritto da L1 all'iterazione precedente: la fusione è
+; legale, ma il loop fuso ha una dipendenza tra iterazioni e non è parallelo.
+; CHECK-LABEL: @positive_distance(
+; CHECK:       h1:
+; CHECK-NEXT:    [[I:%.*]] = phi i32
+; CHECK:         br label %h1{{$}}
+; CHECK:         [[J1:%.*]] = add nsw i32 [[I]], -1
+; CHECK-NEXT:    [[LA:%.*]] = getelementptr inbounds i32, ptr %A, i32 [[J1]]
+; CHECK-NEXT:    load i32, ptr [[LA]], align 4{{$}}
+; CHECK-NOT:   h2:
+; CHECK:       ret void
+define void @positive_distance(ptr noalias %A, ptr noalias %B, i32 %n) {
+entry:
+  br label %h1
+h1:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %b1 ]
+  %c1 = icmp slt i32 %i, %n
+  br i1 %c1, label %b1, label %x1
+b1:
+  %pa = getelementptr inbounds i32, ptr %A, i32 %i
+  store i32 %i, ptr %pa
+  %i.next = add nsw i32 %i, 1
+  br label %h1
+x1:
+  br label %h2
+h2:
+  %j = phi i32 [ 0, %x1 ], [ %j.next, %b2 ]
+  %c2 = icmp slt i32 %j, %n
+  br i1 %c2, label %b2, label %x2
+b2:
+  %j1 = add nsw i32 %j, -1
+  %la = getelementptr inbounds i32, ptr %A, i32 %j1
+  %v = load i32, ptr %la
+  %pb = getelementptr inbounds i32, ptr %B, i32 %j
+  store i32 %v, ptr %pb
+  %j.next = add nsw i32 %j, 1
+  br label %h2
+x2:
+  ret void
+}
+
+; Come @forward, ma L2 usa direttamente %i (IR non in forma LCSSA): dopo la
+; fusione scriverebbe il valore dell'iterazione corrente invece di %n.
+; CHECK-LABEL: @l1_value_used_in_l2(
+; CHECK:       h1:
+; CHECK:       h2:
+; CHECK:         store i32 %i, ptr %pb
+; CHECK:       ret void
+define void @l1_value_used_in_l2(ptr noalias %A, ptr noalias %B, i32 %n) {
+entry:
+  br label %h1
+h1:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %b1 ]
+  %c1 = icmp slt i32 %i, %n
+  br i1 %c1, label %b1, label %x1
+b1:
+  %pa = getelementptr inbounds i32, ptr %A, i32 %i
+  store i32 %i, ptr %pa
+  %i.next = add nsw i32 %i, 1
+  br label %h1
+x1:
+  br label %h2
+h2:
+  %j = phi i32 [ 0, %x1 ], [ %j.next, %b2 ]
+  %c2 = icmp slt i32 %j, %n
+  br i1 %c2, label %b2, label %x2
+b2:
+  %pb = getelementptr inbounds i32, ptr %B, i32 %j
+  store i32 %i, ptr %pb
+  %j.next = add nsw i32 %j, 1
+  br label %h2
+x2:
+  ret void
+}
+
+; CHECK: [[LOOP]] = distinct !{[[LOOP]], [[PAR:![0-9]+]], [[VEC:![0-9]+]]}
+; CHECK: [[PAR]] = !{!"llvm.loop.parallel_accesses", [[AG]]}
+; CHECK: [[VEC]] = !{!"llvm.loop.vectorize.enable", i1 true}
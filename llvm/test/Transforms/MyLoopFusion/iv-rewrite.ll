@@ -0,0 +1,53 @@
+; RUN: opt -passes=my-loop-fusion -aa-pipeline=basic-aa -S < %s | FileCheck %s
+; RUN: opt -passes=my-loop-fusion -aa-pipeline=basic-aa -pass-remarks=my-loop-fusion \
+; RUN:     -disable-output < %s 2>&1 | FileCheck %s --check-prefix=REMARK
+
+; Riscrittura delle induction variable di L2: con lo stesso trip count ogni IV
+; {Start,+,Step}<L2> diventa {Start,+,Step}<L1> e viene calcolata nell'header del
+; loop fuso, qualunque sia il suo valore iniziale, il passo o la direzione.
+
+; REMARK: loop in h1 fused with loop in h2
+
+; %j è uguale alla IV di L1, %d parte da 100 e decresce, %p parte da 5 con passo 2.
+define void @iv_rewrite(ptr noalias %A, ptr noalias %B, i32 %n) {
+; CHECK-LABEL: @iv_rewrite(
+; CHECK:       h1:
+; CHECK-NEXT:    [[I:%.*]] = phi i32
+; CHECK:         [[D:%.*]] = {{add|sub}} {{.*}}100
+; CHECK:         [[P:%.*]] = add i32 {{%.*}}, 5
+; CHECK:         icmp slt i32 [[I]], %n
+; CHECK:         getelementptr inbounds i32, ptr %B, i32 [[P]]
+; CHECK-NEXT:    add i32 [[D]], [[I]]
+; CHECK-NOT:   h2:
+; CHECK:       ret void
+;
+entry:
+  br label %h1
+h1:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %b1 ]
+  %c1 = icmp slt i32 %i, %n
+  br i1 %c1, label %b1, label %x1
+b1:
+  %pa = getelementptr inbounds i32, ptr %A, i32 %i
+  store i32 %i, ptr %pa, align 4
+  %i.next = add nsw i32 %i, 1
+  br label %h1
+x1:
+  br label %h2
+h2:
+  %j = phi i32 [ 0, %x1 ], [ %j.next, %b2 ]
+  %d = phi i32 [ 100, %x1 ], [ %d.next, %b2 ]
+  %p = phi i32 [ 5, %x1 ], [ %p.next, %b2 ]
+  %c2 = icmp slt i32 %j, %n
+  br i1 %c2, label %b2, label %x2
+b2:
+  %pb = getelementptr inbounds i32, ptr %B, i32 %p
+  %s = add i32 %d, %j
+  store i32 %s, ptr %pb, align 4
+  %j.next = add nsw i32 %j, 1
+  %d.next = add nsw i32 %d, -1
+  %p.next = add nsw i32 %p, 2
+  br label %h2
+x2:
+  ret void
+}
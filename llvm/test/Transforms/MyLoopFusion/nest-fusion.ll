@@ -0,0 +1,114 @@
+; RUN: opt -passes=my-loop-fusion -aa-pipeline=basic-aa -S < %s | FileCheck %s
+; RUN: opt -passes=my-loop-fusion -aa-pipeline=basic-aa -pass-remarks=my-loop-fusion \
+; RUN:     -pass-remarks-missed=my-loop-fusion -disable-output < %s 2>&1 | FileCheck %s --check-prefix=REMARK
+
+; Fusione di loop nest: due nest perfetti con la stessa profondità e gli stessi trip
+; count vengono fusi a partire dal loop più esterno, poi i loop interni (diventati
+; fratelli nel loop fuso) vengono fusi al livello successivo.
+
+; REMARK: loop in o1 fused with loop in o2
+; REMARK-NEXT: loop in h1 fused with loop in h2
+; REMARK-NEXT: loop in o1 not fused with loop in h2: loop nests are not perfectly nested with matching depth and trip counts
+
+; A[i][j] viene scritto dal primo nest e letto dal secondo nella stessa iterazione.
+define void @nest(ptr noalias %A, ptr noalias %B) {
+; CHECK-LABEL: @nest(
+; CHECK:       o1:
+; CHECK-NEXT:    [[I:%.*]] = phi i32
+; CHECK:       h1:
+; CHECK-NEXT:    [[J:%.*]] = phi i32
+; CHECK:         getelementptr inbounds [64 x [64 x i32]], ptr %A, i32 0, i32 [[I]], i32 [[J]]
+; CHECK:         getelementptr inbounds [64 x [64 x i32]], ptr %A, i32 0, i32 [[I]], i32 [[J]]
+; CHECK-NEXT:    load i32
+; CHECK:         getelementptr inbounds [64 x [64 x i32]], ptr %B, i32 0, i32 [[I]], i32 [[J]]
+; CHECK-NOT:   o2:
+; CHECK-NOT:   h2:
+; CHECK:       ret void
+;
+entry:
+  br label %o1
+o1:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %o1.latch ]
+  %co1 = icmp slt i32 %i, 64
+  br i1 %co1, label %in1.ph, label %x1
+in1.ph:
+  br label %h1
+h1:
+  %j = phi i32 [ 0, %in1.ph ], [ %j.next, %b1 ]
+  %c1 = icmp slt i32 %j, 60
+  br i1 %c1, label %b1, label %o1.latch
+b1:
+  %pa = getelementptr inbounds [64 x [64 x i32]], ptr %A, i32 0, i32 %i, i32 %j
+  store i32 %j, ptr %pa, align 4
+  %j.next = add nsw i32 %j, 1
+  br label %h1
+o1.latch:
+  %i.next = add nsw i32 %i, 1
+  br label %o1
+x1:
+  br label %o2
+o2:
+  %k = phi i32 [ 0, %x1 ], [ %k.next, %o2.latch ]
+  %co2 = icmp slt i32 %k, 64
+  br i1 %co2, label %in2.ph, label %x2
+in2.ph:
+  br label %h2
+h2:
+  %l = phi i32 [ 0, %in2.ph ], [ %l.next, %b2 ]
+  %c2 = icmp slt i32 %l, 60
+  br i1 %c2, label %b2, label %o2.latch
+b2:
+  %la = getelementptr inbounds [64 x [64 x i32]], ptr %A, i32 0, i32 %k, i32 %l
+  %v = load i32, ptr %la, align 4
+  %pb = getelementptr inbounds [64 x [64 x i32]], ptr %B, i32 0, i32 %k, i32 %l
+  store i32 %v, ptr %pb, align 4
+  %l.next = add nsw i32 %l, 1
+  br label %h2
+o2.latch:
+  %k.next = add nsw i32 %k, 1
+  br label %o2
+x2:
+  ret void
+}
+
+; Il primo loop è un nest di profondità 2, il secondo un loop singolo.
+define void @depth_mismatch(ptr noalias %A, ptr noalias %B) {
+; CHECK-LABEL: @depth_mismatch(
+; CHECK:       o1:
+; CHECK:       h2:
+; CHECK:       ret void
+;
+entry:
+  br label %o1
+o1:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %o1.latch ]
+  %co1 = icmp slt i32 %i, 64
+  br i1 %co1, label %in1.ph, label %x1
+in1.ph:
+  br label %h1
+h1:
+  %j = phi i32 [ 0, %in1.ph ], [ %j.next, %b1 ]
+  %c1 = icmp slt i32 %j, 60
+  br i1 %c1, label %b1, label %o1.latch
+b1:
+  %pa = getelementptr inbounds [64 x [64 x i32]], ptr %A, i32 0, i32 %i, i32 %j
+  store i32 %j, ptr %pa, align 4
+  %j.next = add nsw i32 %j, 1
+  br label %h1
+o1.latch:
+  %i.next = add nsw i32 %i, 1
+  br label %o1
+x1:
+  br label %h2
+h2:
+  %k = phi i32 [ 0, %x1 ], [ %k.next, %b2 ]
+  %c2 = icmp slt i32 %k, 64
+  br i1 %c2, label %b2, label %x2
+b2:
+  %pb = getelementptr inbounds i32, ptr %B, i32 %k
+  store i32 %k, ptr %pb, align 4
+  %k.next = add nsw i32 %k, 1
+  br label %h2
+x2:
+  ret void
+}
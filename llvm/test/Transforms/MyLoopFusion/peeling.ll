@@ -0,0 +1,127 @@
+; RUN: opt -passes=my-loop-fusion -aa-pipeline=basic-aa -S < %s | FileCheck %s
+; RUN: opt -passes=my-loop-fusion -aa-pipeline=basic-aa -pass-remarks=my-loop-fusion \
+; RUN:     -pass-remarks-missed=my-loop-fusion -disable-output < %s 2>&1 | FileCheck %s --check-prefix=REMARK
+
+; Allineamento dei trip count con il peeling: loop che differiscono di poche
+; iterazioni (al massimo -my-loop-fusion-max-peel) vengono fusi dopo aver tolto
+; le iterazioni in più al loop più lungo.
+
+; REMARK: peeled 1 first iterations of loop in h1 to align its trip count
+; REMARK-NEXT: loop in h1 fused with loop in h2
+; REMARK-NEXT: peeled 2 last iterations of loop in h2 to align its trip count
+; REMARK-NEXT: loop in h1 fused with loop in h2
+; REMARK-NEXT: loop in h1 not fused with loop in h2: trip count mismatch
+
+; L1 esegue un'iterazione in più: la prima viene eseguita da una copia posta prima
+; di L1 e nel loop fuso la IV di L1 viene traslata di 1.
+define void @peel_first(ptr noalias %A, ptr noalias %B) {
+; CHECK-LABEL: @peel_first(
+; CHECK:       h1.peel:
+; CHECK:         [[I_PEEL:%.*]] = phi i32
+; CHECK:         icmp ne i32 [[I_PEEL]], 1
+; CHECK:       h1:
+; CHECK-NEXT:    [[I:%.*]] = phi i32 [ 0, %entry.split ]
+; CHECK:         [[SHIFT:%.*]] = add nsw i32 [[I]], 1
+; CHECK-NEXT:    icmp ne i32 [[I]], 999
+; CHECK:         store i32 [[SHIFT]]
+; CHECK-NOT:   h2:
+; CHECK:       ret void
+;
+entry:
+  br label %h1
+h1:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %b1 ]
+  %c1 = icmp slt i32 %i, 1000
+  br i1 %c1, label %b1, label %x1
+b1:
+  %pa = getelementptr inbounds i32, ptr %A, i32 %i
+  store i32 %i, ptr %pa, align 4
+  %i.next = add nsw i32 %i, 1
+  br label %h1
+x1:
+  br label %h2
+h2:
+  %j = phi i32 [ 1, %x1 ], [ %j.next, %b2 ]
+  %c2 = icmp slt i32 %j, 1000
+  br i1 %c2, label %b2, label %x2
+b2:
+  %la = getelementptr inbounds i32, ptr %A, i32 %j
+  %v = load i32, ptr %la, align 4
+  %pb = getelementptr inbounds i32, ptr %B, i32 %j
+  store i32 %v, ptr %pb, align 4
+  %j.next = add nsw i32 %j, 1
+  br label %h2
+x2:
+  ret void
+}
+
+; L2 esegue due iterazioni in più: le ultime vengono eseguite da una copia posta
+; dopo il loop fuso, che riparte dal valore finale della IV.
+define void @peel_last(ptr noalias %A, ptr noalias %B) {
+; CHECK-LABEL: @peel_last(
+; CHECK:       h1:
+; CHECK-NEXT:    [[I:%.*]] = phi i32
+; CHECK:         icmp slt i32 [[I]], 1000
+; CHECK:       h2.peel:
+; CHECK-NEXT:    [[J:%.*]] = phi i32 [ [[LCSSA:%.*]], %x1.split.peel ]
+; CHECK-NEXT:    icmp slt i32 [[J]], 1002
+; CHECK:       ret void
+;
+entry:
+  br label %h1
+h1:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %b1 ]
+  %c1 = icmp slt i32 %i, 1000
+  br i1 %c1, label %b1, label %x1
+b1:
+  %pa = getelementptr inbounds i32, ptr %A, i32 %i
+  store i32 %i, ptr %pa, align 4
+  %i.next = add nsw i32 %i, 1
+  br label %h1
+x1:
+  br label %h2
+h2:
+  %j = phi i32 [ 0, %x1 ], [ %j.next, %b2 ]
+  %c2 = icmp slt i32 %j, 1002
+  br i1 %c2, label %b2, label %x2
+b2:
+  %pb = getelementptr inbounds i32, ptr %B, i32 %j
+  store i32 %j, ptr %pb, align 4
+  %j.next = add nsw i32 %j, 1
+  br label %h2
+x2:
+  ret void
+}
+
+; Quattro iterazioni di differenza superano il limite di default (3).
+define void @too_many(ptr noalias %A, ptr noalias %B) {
+; CHECK-LABEL: @too_many(
+; CHECK:       h1:
+; CHECK:       h2:
+; CHECK:       ret void
+;
+entry:
+  br label %h1
+h1:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %b1 ]
+  %c1 = icmp slt i32 %i, 1000
+  br i1 %c1, label %b1, label %x1
+b1:
+  %pa = getelementptr inbounds i32, ptr %A, i32 %i
+  store i32 %i, ptr %pa, align 4
+  %i.next = add nsw i32 %i, 1
+  br label %h1
+x1:
+  br label %h2
+h2:
+  %j = phi i32 [ 4, %x1 ], [ %j.next, %b2 ]
+  %c2 = icmp slt i32 %j, 1000
+  br i1 %c2, label %b2, label %x2
+b2:
+  %pb = getelementptr inbounds i32, ptr %B, i32 %j
+  store i32 %j, ptr %pb, align 4
+  %j.next = add nsw i32 %j, 1
+  br label %h2
+x2:
+  ret void
+}
@@ -0,0 +1,69 @@
+; RUN: opt -passes=my-loop-fusion -aa-pipeline=basic-aa -S < %s | FileCheck %s
+; RUN: opt -passes=my-loop-fusion -aa-pipeline=basic-aa -pass-remarks=my-loop-fusion \
+; RUN:     -disable-output < %s 2>&1 | FileCheck %s --check-prefix=REMARK
+
+; Fusione di loop ruotati (do-while, l'uscita è nel latch) con guardie equivalenti:
+; la guardia di L2 viene eliminata e il body di L1 salta direttamente a quello di L2,
+; che contiene il latch del loop fuso.
+
+; REMARK: loop in l1 fused with loop in l2
+
+define void @rotated(ptr noalias %A, ptr noalias %B, i32 %n) {
+; CHECK-LABEL: @rotated(
+; CHECK:       entry:
+; CHECK:         br i1 {{%.*}}, label %l1.ph, label %exit
+; CHECK:       l1:
+; CHECK-NEXT:    [[I:%.*]] = phi i32 [ 0, %l1.ph ], [ {{%.*}}, %l2 ]
+; CHECK-NEXT:    [[J:%.*]] = phi i32 [ 0, %l1.ph ], [ [[J_NEXT:%.*]], %l2 ]
+; CHECK:         store i32 [[I]], ptr {{%.*}}, align 4, !llvm.access.group [[AG:![0-9]+]]
+; CHECK-NEXT:    {{%.*}} = add nsw i32 [[I]], 1
+; CHECK-NEXT:    br label %l2
+; CHECK:       l2:
+; CHECK:         load i32, ptr {{%.*}}, align 4, !llvm.access.group [[AG]]
+; CHECK:         [[J_NEXT]] = add nsw i32 [[J]], 1
+; CHECK-NEXT:    [[C:%.*]] = icmp slt i32 [[J_NEXT]], %n
+; CHECK-NEXT:    br i1 [[C]], label %l1, label %l2.exit, !llvm.loop
+; CHECK-NOT:   l2.ph:
+; CHECK:       ret void
+;
+entry:
+  %g1 = icmp sgt i32 %n, 0
+  br i1 %g1, label %l1.ph, label %l1.skip
+
+l1.ph:
+  br label %l1
+
+l1:
+  %i = phi i32 [ 0, %l1.ph ], [ %i.next, %l1 ]
+  %pa = getelementptr inbounds i32, ptr %A, i32 %i
+  store i32 %i, ptr %pa, align 4
+  %i.next = add nsw i32 %i, 1
+  %c1 = icmp slt i32 %i.next, %n
+  br i1 %c1, label %l1, label %l1.exit
+
+l1.exit:
+  br label %l1.skip
+
+l1.skip:
+  %g2 = icmp sgt i32 %n, 0
+  br i1 %g2, label %l2.ph, label %exit
+
+l2.ph:
+  br label %l2
+
+l2:
+  %j = phi i32 [ 0, %l2.ph ], [ %j.next, %l2 ]
+  %la = getelementptr inbounds i32, ptr %A, i32 %j
+  %v = load i32, ptr %la, align 4
+  %pb = getelementptr inbounds i32, ptr %B, i32 %j
+  store i32 %v, ptr %pb, align 4
+  %j.next = add nsw i32 %j, 1
+  %c2 = icmp slt i32 %j.next, %n
+  br i1 %c2, label %l2, label %l2.exit
+
+l2.exit:
+  br label %exit
+
+exit:
+  ret void
+}
@@ -0,0 +1,77 @@
+; RUN: opt %loadloopopt -passes=my-loop-opt -aa-pipeline=basic-aa -S < %s | FileCheck %s
+; RUN: opt %loadloopopt -passes=my-loop-opt -aa-pipeline=basic-aa -pass-remarks='localopts|my-licm|my-loop-fusion' \
+; RUN:     -disable-output < %s 2>&1 | FileCheck %s --check-prefix=REMARK
+; RUN: opt %loadloopopt -O2 -enable-my-loop-opt -S < %s | FileCheck %s --check-prefix=O2
+; RUN: opt %loadloopopt -O2 -S < %s | FileCheck %s --check-prefix=O2-STOCK
+
+; Pipeline my-loop-opt: localopts, my-licm e my-loop-fusion vengono eseguiti sulla
+; stessa function fino a un punto fisso.
+
+; REMARK: udiv by 8 lowered without a hardware divide
+; REMARK: hoisting mul
+; REMARK: loop in h1 fused with loop in h2
+
+; La divisione viene sostituita da uno shift, l'espressione invariante viene spostata
+; nel preheader e i due loop vengono fusi.
+; CHECK-LABEL: @pipeline(
+; CHECK:       entry:
+; CHECK-NEXT:    [[INV:%.*]] = mul i32 %n, 3
+; CHECK:       h1:
+; CHECK-NEXT:    [[I:%.*]] = phi i32
+; CHECK-NOT:     udiv
+; CHECK:         [[Q:%.*]] = lshr i32 [[I]], 3
+; CHECK-NEXT:    add i32 [[Q]], [[INV]]
+; CHECK:         load i32, ptr {{%.*}}, align 4, !llvm.access.group
+; CHECK-NOT:   h2:
+; CHECK:       ret void
+define void @pipeline(ptr noalias %a, ptr noalias %b, i32 %n) {
+entry:
+  br label %h1
+
+h1:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %b1 ]
+  %inv = mul i32 %n, 3
+  %c1 = icmp slt i32 %i, %n
+  br i1 %c1, label %b1, label %x1
+
+b1:
+  %q = udiv i32 %i, 8
+  %v = add i32 %q, %inv
+  %pa = getelementptr inbounds i32, ptr %a, i32 %i
+  store i32 %v, ptr %pa, align 4
+  %i.next = add nsw i32 %i, 1
+  br label %h1
+
+x1:
+  br label %h2
+
+h2:
+  %j = phi i32 [ 0, %x1 ], [ %j.next, %b2 ]
+  %c2 = icmp slt i32 %j, %n
+  br i1 %c2, label %b2, label %x2
+
+b2:
+  %pa2 = getelementptr inbounds i32, ptr %a, i32 %j
+  %va = load i32, ptr %pa2, align 4
+  %w = shl i32 %va, 1
+  %pb = getelementptr inbounds i32, ptr %b, i32 %j
+  store i32 %w, ptr %pb, align 4
+  %j.next = add nsw i32 %j, 1
+  br label %h2
+
+x2:
+  ret void
+}
+
+; Con -enable-my-loop-opt localopts viene eseguito all'extension point "optimizer last",
+; dopo instcombine: la divisione per 7 resta abbassata anche con -O2.
+; O2-LABEL: @div7(
+; O2-NOT:     udiv
+; O2:         ret i32
+; O2-STOCK-LABEL: @div7(
+; O2-STOCK:     udiv i32 %x, 7
+define i32 @div7(i32 %x) {
+entry:
+  %d = udiv i32 %x, 7
+  ret i32 %d
+}
@@ -0,0 +1,240 @@
+#!/usr/bin/env python3
+"""Misura tempo di compilazione ed effetto dei passi degli assignment.
+
+Per ogni kernel (file .ll) esegue opt con tre configurazioni:
+  - O0:    nessuna trasformazione (solo il verifier)
+  - mine:  localopts, my-iv-sr, my-licm (con frequenze dei blocchi) e my-loop-fusion
+  - stock: licm e loop-fusion di LLVM
+e scrive in formato JSON, per ogni configurazione:
+  - il tempo di compilazione (mediana su --repeat esecuzioni) e il tempo di ogni passo (-time-passes)
+  - il numero di istruzioni IR prima e dopo, in totale e per opcode
+  - i contatori STATISTIC dei passi, se opt è compilato con le statistiche
+  - con --run, il tempo di esecuzione del kernel ottimizzato e l'exit code di main
+
+Con --run il modulo ottimizzato viene compilato con llc e collegato con --cc, con le stesse
+opzioni per tutte le configurazioni (-O di llc fissato da --codegen-opt-level). Viene misurato
+solo l'eseguibile: la compilazione avviene prima delle misure. Per ogni kernel vengono
+riportati anche gli speedup del tempo di esecuzione rispetto a O0 e di mine rispetto a stock,
+e lo script termina con errore se le configurazioni restituiscono exit code diversi.
+
+Esempio:
+  my-loop-opt-bench.py --opt build/bin/opt --run --llc build/bin/llc -o results.json \\
+      llvm/utils/my-loop-opt-kernels/*.ll
+"""
+
+import argparse
+import json
+import os
+import re
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+CONFIGS = {
+    "O0": "verify",
+    "mine": "localopts,function(loop-mssa(my-iv-sr),my-licm-bfi,my-loop-fusion)",
+    "stock": "function(loop-mssa(licm),loop-fusion)",
+}
+
+# Istruzioni contate anche singolarmente: quelle che i passi eliminano o spostano.
+TRACKED_OPCODES = ("mul", "udiv", "sdiv", "urem", "srem", "load", "store", "br", "phi")
+
+INSTRUCTION_RE = re.compile(r"^\s+(?:%[-\w.$]+\s*=\s*)?(?:tail\s+|musttail\s+|notail\s+)?(\w+)\b")
+# Riga del report di -time-passes: "  0.0012 ( 72.3%)  ...  0.0013 ( 72.3%)  LoopFusion".
+TIMER_RE = re.compile(r"^\s*((?:[\d.]+\s+\(\s*[\d.]+%\)\s+)+)(.+?)\s*$")
+TIMER_VALUE_RE = re.compile(r"([\d.]+)\s+\(\s*[\d.]+%\)")
+
+
+def count_instructions(path):
+    """Conta le istruzioni delle function definite nel file .ll."""
+    total = 0
+    by_opcode = {op: 0 for op in TRACKED_OPCODES}
+    in_function = False
+    with open(path) as f:
+        for line in f:
+            if line.startswith("define "):
+                in_function = True
+                continue
+            if line.startswith("}"):
+                in_function = False
+                continue
+            if not in_function:
+                continue
+            match = INSTRUCTION_RE.match(line)
+            # Le righe non indentate sono label, quelle vuote o di commento non corrispondono.
+            if not match:
+                continue
+            total += 1
+            opcode = match.group(1)
+            if opcode in by_opcode:
+                by_opcode[opcode] += 1
+    return {"total": total, "by_opcode": by_opcode}
+
+
+def parse_pass_times(path):
+    """Estrae il wall time (in secondi) di ogni passo dal report di -time-passes."""
+    times = {}
+    if not os.path.exists(path):
+        return times
+    with open(path) as f:
+        for line in f:
+            match = TIMER_RE.match(line)
+            if not match:
+                continue
+            name = match.group(2)
+            if name == "Total":
+                continue
+            # L'ultima colonna prima del nome è il wall time.
+            wall = float(TIMER_VALUE_RE.findall(match.group(1))[-1])
+            times[name] = times.get(name, 0.0) + wall
+    return times
+
+
+def opt_command(args, passes, input_path, output_path):
+    cmd = [args.opt]
+    for plugin in args.load_pass_plugin:
+        cmd.append("-load-pass-plugin=" + plugin)
+    cmd += ["-passes=" + passes, "-aa-pipeline=" + args.aa_pipeline, "-S", input_path, "-o", output_path]
+    return cmd + args.opt_arg
+
+
+def run_checked(cmd):
+    result = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE, universal_newlines=True)
+    if result.returncode != 0:
+        sys.exit("error: '{}' failed:\n{}".format(" ".join(cmd), result.stderr))
+    return result
+
+
+def collect_stats(args, passes, kernel, tmpdir):
+    """Contatori STATISTIC in JSON, oppure None se opt non è compilato con le statistiche."""
+    stats_path = os.path.join(tmpdir, "stats.json")
+    cmd = opt_command(args, passes, kernel, os.devnull)
+    run_checked(cmd + ["-stats", "-stats-json", "-info-output-file=" + stats_path])
+    try:
+        with open(stats_path) as f:
+            return json.load(f)
+    except (OSError, ValueError):
+        return None
+
+
+def build_executable(args, ir_path, tmpdir, name):
+    """Compila il modulo con llc e lo collega con --cc, con le stesse opzioni per ogni configurazione.
+
+    Il livello di ottimizzazione di llc è fissato da --codegen-opt-level: lli userebbe sempre -O2,
+    che esegue anche passi IR (es. loop-reduce) e nasconderebbe le differenze tra le configurazioni.
+    """
+    obj_path = os.path.join(tmpdir, name + ".o")
+    exe_path = os.path.join(tmpdir, name)
+    run_checked([args.llc, "-O" + args.codegen_opt_level, "-filetype=obj", "-relocation-model=pic",
+                 ir_path, "-o", obj_path] + args.llc_arg)
+    run_checked([args.cc, obj_path, "-o", exe_path] + args.link_arg)
+    return exe_path
+
+
+def measure_runtime(args, exe_path):
+    """Mediana del tempo di esecuzione dell'eseguibile e suo exit code.
+
+    L'exit code (il valore restituito da main) permette di controllare che le configurazioni
+    calcolino lo stesso risultato.
+    """
+    samples = []
+    for _ in range(args.repeat):
+        start = time.perf_counter()
+        result = subprocess.run([exe_path] + args.run_arg, stdout=subprocess.DEVNULL,
+                                stderr=subprocess.PIPE, universal_newlines=True)
+        samples.append(time.perf_counter() - start)
+        if result.returncode < 0:
+            sys.exit("error: {} terminated by signal {}:\n{}".format(exe_path, -result.returncode,
+                                                                     result.stderr))
+    return {"time": statistics.median(samples), "exit_code": result.returncode}
+
+
+def compute_speedups(configs):
+    """Speedup del tempo di esecuzione rispetto a O0 e di mine rispetto a stock (> 1: più veloce)."""
+    def ratio(base, config):
+        return configs[base]["runtime"]["time"] / configs[config]["runtime"]["time"]
+
+    speedups = {config + "_vs_O0": ratio("O0", config) for config in configs if config != "O0"}
+    speedups["mine_vs_stock"] = ratio("stock", "mine")
+    return speedups
+
+
+def bench_kernel(args, kernel, tmpdir):
+    result = {"instructions_before": count_instructions(kernel), "configs": {}}
+    for config, passes in CONFIGS.items():
+        output_path = os.path.join(tmpdir, config + ".ll")
+        timers_path = os.path.join(tmpdir, config + ".timers.txt")
+        cmd = opt_command(args, passes, kernel, output_path)
+
+        compile_times = []
+        for _ in range(args.repeat):
+            start = time.perf_counter()
+            run_checked(cmd)
+            compile_times.append(time.perf_counter() - start)
+
+        # Il report dei timer viene scritto una volta sola, fuori dalle misure del tempo totale.
+        if os.path.exists(timers_path):
+            os.remove(timers_path)
+        run_checked(cmd + ["-time-passes", "-info-output-file=" + timers_path])
+
+        entry = {
+            "passes": passes,
+            "compile_time": statistics.median(compile_times),
+            "pass_times": parse_pass_times(timers_path),
+            "instructions_after": count_instructions(output_path),
+        }
+        if args.stats:
+            entry["stats"] = collect_stats(args, passes, kernel, tmpdir)
+        if args.run:
+            entry["runtime"] = measure_runtime(args, build_executable(args, output_path, tmpdir, config))
+        result["configs"][config] = entry
+
+    if args.run:
+        exit_codes = {config: entry["runtime"]["exit_code"] for config, entry in result["configs"].items()}
+        if len(set(exit_codes.values())) != 1:
+            sys.exit("error: configurations of {} disagree on the exit code: {}".format(kernel, exit_codes))
+        result["speedup"] = compute_speedups(result["configs"])
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("kernels", nargs="+", help="file .ll da misurare")
+    parser.add_argument("-o", "--output", default="-", help="file JSON di output (default: stdout)")
+    parser.add_argument("--opt", default="opt", help="opt da usare")
+    parser.add_argument("--llc", default="llc", help="llc da usare con --run")
+    parser.add_argument("--cc", default="cc", help="compilatore C usato per il link con --run")
+    parser.add_argument("--load-pass-plugin", action="append", default=[],
+                        help="pass plugin da caricare (es. LoopOptPipeline.so)")
+    parser.add_argument("--aa-pipeline", default="basic-aa")
+    parser.add_argument("--opt-arg", action="append", default=[], help="argomento aggiuntivo per opt")
+    parser.add_argument("--repeat", type=int, default=5, help="esecuzioni per ogni misura (default: 5)")
+    parser.add_argument("--stats", action="store_true", help="raccoglie i contatori STATISTIC")
+    parser.add_argument("--run", action="store_true", help="misura anche il tempo di esecuzione")
+    parser.add_argument("--codegen-opt-level", default="0", choices=["0", "1", "2", "3"],
+                        help="livello -O di llc, uguale per tutte le configurazioni (default: 0)")
+    parser.add_argument("--llc-arg", action="append", default=[], help="argomento aggiuntivo per llc")
+    parser.add_argument("--link-arg", action="append", default=[], help="argomento aggiuntivo per il link")
+    parser.add_argument("--run-arg", action="append", default=[], help="argomento passato al kernel con --run")
+    args = parser.parse_args()
+    if args.run and shutil.which(args.cc) is None:
+        sys.exit("error: --run needs a C compiler to link the kernels ('{}' not found)".format(args.cc))
+
+    results = {}
+    for kernel in args.kernels:
+        with tempfile.TemporaryDirectory() as tmpdir:
+            results[kernel] = bench_kernel(args, kernel, tmpdir)
+
+    if args.output == "-":
+        json.dump(results, sys.stdout, indent=2)
+        sys.stdout.write("\n")
+    else:
+        with open(args.output, "w") as f:
+            json.dump(results, f, indent=2)
+
+
+if __name__ == "__main__":
+    main()
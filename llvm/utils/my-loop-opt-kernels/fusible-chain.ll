@@ -0,0 +1,125 @@
+; Kernel per my-loop-opt-bench.py: catena di loop adiacenti con lo stesso trip count
+; (my-loop-fusion). Ogni loop legge nella stessa iterazione gli elementi scritti
+; dal precedente, quindi i quattro loop possono essere fusi in uno solo e gli array
+; intermedi vengono letti mentre sono ancora in cache. L'ultimo loop parte da 1 e
+; ha un'iterazione in meno: la prima iterazione del loop fuso viene tolta con il
+; peeling e la sua copia viene eseguita prima della catena.
+; main restituisce un checksum, che deve essere uguale con tutte le configurazioni.
+
+@a = global [65536 x i32] zeroinitializer, align 16
+@b = global [65536 x i32] zeroinitializer, align 16
+@c = global [65536 x i32] zeroinitializer, align 16
+
+define void @kernel(i32 %rounds) {
+entry:
+  br label %round
+
+round:
+  %r = phi i32 [ 0, %entry ], [ %r.next, %round.latch ]
+  br label %h1
+
+h1:
+  %i1 = phi i32 [ 0, %round ], [ %i1.next, %b1 ]
+  %c1 = icmp ult i32 %i1, 65536
+  br i1 %c1, label %b1, label %x1
+
+b1:
+  %v1 = add i32 %i1, %r
+  %pa1 = getelementptr inbounds [65536 x i32], ptr @a, i32 0, i32 %i1
+  store i32 %v1, ptr %pa1, align 4
+  %i1.next = add nuw nsw i32 %i1, 1
+  br label %h1
+
+x1:
+  br label %h2
+
+h2:
+  %i2 = phi i32 [ 0, %x1 ], [ %i2.next, %b2 ]
+  %c2 = icmp ult i32 %i2, 65536
+  br i1 %c2, label %b2, label %x2
+
+b2:
+  %pa2 = getelementptr inbounds [65536 x i32], ptr @a, i32 0, i32 %i2
+  %va2 = load i32, ptr %pa2, align 4
+  %v2 = shl i32 %va2, 1
+  %pb2 = getelementptr inbounds [65536 x i32], ptr @b, i32 0, i32 %i2
+  store i32 %v2, ptr %pb2, align 4
+  %i2.next = add nuw nsw i32 %i2, 1
+  br label %h2
+
+x2:
+  br label %h3
+
+h3:
+  %i3 = phi i32 [ 0, %x2 ], [ %i3.next, %b3 ]
+  %c3 = icmp ult i32 %i3, 65536
+  br i1 %c3, label %b3, label %x3
+
+b3:
+  %pa3 = getelementptr inbounds [65536 x i32], ptr @a, i32 0, i32 %i3
+  %va3 = load i32, ptr %pa3, align 4
+  %pb3 = getelementptr inbounds [65536 x i32], ptr @b, i32 0, i32 %i3
+  %vb3 = load i32, ptr %pb3, align 4
+  %v3 = add i32 %va3, %vb3
+  %pc3 = getelementptr inbounds [65536 x i32], ptr @c, i32 0, i32 %i3
+  store i32 %v3, ptr %pc3, align 4
+  %i3.next = add nuw nsw i32 %i3, 1
+  br label %h3
+
+x3:
+  br label %h4
+
+h4:
+  %i4 = phi i32 [ 1, %x3 ], [ %i4.next, %b4 ]
+  %c4 = icmp ult i32 %i4, 65536
+  br i1 %c4, label %b4, label %x4
+
+b4:
+  %pc4 = getelementptr inbounds [65536 x i32], ptr @c, i32 0, i32 %i4
+  %vc4 = load i32, ptr %pc4, align 4
+  %pa4 = getelementptr inbounds [65536 x i32], ptr @a, i32 0, i32 %i4
+  %va4 = load i32, ptr %pa4, align 4
+  %v4 = mul i32 %vc4, %va4
+  %pb4 = getelementptr inbounds [65536 x i32], ptr @b, i32 0, i32 %i4
+  store i32 %v4, ptr %pb4, align 4
+  %i4.next = add nuw nsw i32 %i4, 1
+  br label %h4
+
+x4:
+  br label %round.latch
+
+round.latch:
+  %r.next = add nuw nsw i32 %r, 1
+  %cr = icmp ult i32 %r.next, %rounds
+  br i1 %cr, label %round, label %exit
+
+exit:
+  ret void
+}
+
+; Checksum di @b, in una function separata perché non faccia parte della catena.
+define i32 @checksum() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %s = phi i32 [ 0, %entry ], [ %s.next, %loop ]
+  %p = getelementptr inbounds [65536 x i32], ptr @b, i32 0, i32 %i
+  %v = load i32, ptr %p, align 4
+  %s.next = add i32 %s, %v
+  %i.next = add nuw nsw i32 %i, 1
+  %c = icmp ult i32 %i.next, 65536
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret i32 %s.next
+}
+
+define i32 @main() {
+entry:
+  call void @kernel(i32 300)
+  %s = call i32 @checksum()
+  %res = and i32 %s, 255
+  ret i32 %res
+}
@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+"""Genera un modulo sintetico con molte function e molti loop per my-loop-opt-bench.py.
+
+Ogni function contiene --loops loop adiacenti con lo stesso trip count. Il loop j legge un
+array e scrive l'altro nello stesso indice, quindi tutta la catena può essere fusa. Il body
+contiene un'espressione invariante (my-licm), una divisione per costante (localopts) e una
+moltiplicazione dell'induction variable (my-iv-sr). main chiama tutte le function sugli
+stessi array e restituisce un checksum, così il modulo può essere eseguito con --run.
+
+Esempio:
+  gen-synthetic.py --functions 2000 --loops 4 -o synthetic.ll
+"""
+
+import argparse
+import sys
+
+ARRAY_SIZE = 256
+TRIP_COUNT = 64
+DIVISORS = (3, 5, 7, 10, 12)
+
+
+def emit_loop(out, j, last, src, dst):
+    """Loop j della function: dst[i] = (src[i] + k * C + i / D) ^ (i * 3)."""
+    pre = "entry" if j == 0 else "x{}".format(j - 1)
+    out.append("h{j}:".format(j=j))
+    out.append("  %i{j} = phi i32 [ 0, %{pre} ], [ %i{j}.next, %b{j} ]".format(j=j, pre=pre))
+    out.append("  %c{j} = icmp slt i32 %i{j}, %n".format(j=j))
+    out.append("  br i1 %c{j}, label %b{j}, label %x{j}".format(j=j))
+    out.append("b{j}:".format(j=j))
+    out.append("  %inv{j} = mul i32 %k, {c}".format(j=j, c=17 + 2 * j))
+    out.append("  %q{j} = udiv i32 %i{j}, {d}".format(j=j, d=DIVISORS[j % len(DIVISORS)]))
+    out.append("  %ps{j} = getelementptr inbounds i32, ptr %{src}, i32 %i{j}".format(j=j, src=src))
+    out.append("  %vs{j} = load i32, ptr %ps{j}, align 4".format(j=j))
+    out.append("  %m{j} = mul nsw i32 %i{j}, 3".format(j=j))
+    out.append("  %t{j} = add i32 %vs{j}, %inv{j}".format(j=j))
+    out.append("  %u{j} = add i32 %t{j}, %q{j}".format(j=j))
+    out.append("  %w{j} = xor i32 %u{j}, %m{j}".format(j=j))
+    out.append("  %pd{j} = getelementptr inbounds i32, ptr %{dst}, i32 %i{j}".format(j=j, dst=dst))
+    out.append("  store i32 %w{j}, ptr %pd{j}, align 4".format(j=j))
+    out.append("  %i{j}.next = add nsw i32 %i{j}, 1".format(j=j))
+    out.append("  br label %h{j}".format(j=j))
+    out.append("x{j}:".format(j=j))
+    out.append("  ret void" if last else "  br label %h{}".format(j + 1))
+
+
+def emit_function(out, index, loops):
+    out.append("define void @f{}(ptr noalias %a, ptr noalias %b, i32 %n, i32 %k) {{".format(index))
+    out.append("entry:")
+    out.append("  br label %h0")
+    for j in range(loops):
+        # Loop consecutivi leggono l'array scritto dal precedente.
+        src, dst = ("a", "b") if j % 2 == 0 else ("b", "a")
+        emit_loop(out, j, j == loops - 1, src, dst)
+    out.append("}")
+    out.append("")
+
+
+def emit_main(out, functions):
+    out.append("define i32 @main() {")
+    out.append("entry:")
+    for index in range(functions):
+        out.append("  call void @f{i}(ptr @A, ptr @B, i32 {n}, i32 {i})".format(i=index, n=TRIP_COUNT))
+    out.append("  br label %loop")
+    out.append("loop:")
+    out.append("  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]")
+    out.append("  %s = phi i32 [ 0, %entry ], [ %s.next, %loop ]")
+    out.append("  %pa = getelementptr inbounds [{n} x i32], ptr @A, i32 0, i32 %i".format(n=ARRAY_SIZE))
+    out.append("  %va = load i32, ptr %pa, align 4")
+    out.append("  %pb = getelementptr inbounds [{n} x i32], ptr @B, i32 0, i32 %i".format(n=ARRAY_SIZE))
+    out.append("  %vb = load i32, ptr %pb, align 4")
+    out.append("  %v = add i32 %va, %vb")
+    out.append("  %s.next = add i32 %s, %v")
+    out.append("  %i.next = add nuw nsw i32 %i, 1")
+    out.append("  %c = icmp ult i32 %i.next, {n}".format(n=ARRAY_SIZE))
+    out.append("  br i1 %c, label %loop, label %exit")
+    out.append("exit:")
+    out.append("  %res = and i32 %s.next, 255")
+    out.append("  ret i32 %res")
+    out.append("}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--functions", type=int, default=2000, help="numero di function (default: 2000)")
+    parser.add_argument("--loops", type=int, default=4, help="loop per function (default: 4)")
+    parser.add_argument("-o", "--output", default="-", help="file .ll di output (default: stdout)")
+    args = parser.parse_args()
+    if args.functions < 1 or args.loops < 1:
+        sys.exit("error: --functions and --loops must be positive")
+
+    out = ["; Modulo generato da gen-synthetic.py --functions {} --loops {}".format(args.functions, args.loops),
+           "",
+           "@A = global [{} x i32] zeroinitializer, align 16".format(ARRAY_SIZE),
+           "@B = global [{} x i32] zeroinitializer, align 16".format(ARRAY_SIZE),
+           ""]
+    for index in range(args.functions):
+        emit_function(out, index, args.loops)
+    emit_main(out, args.functions)
+
+    text = "\n".join(out) + "\n"
+    if args.output == "-":
+        sys.stdout.write(text)
+    else:
+        with open(args.output, "w") as f:
+            f.write(text)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,79 @@
+; Kernel per my-loop-opt-bench.py: nest di loop con invarianti a livelli diversi
+; (my-licm). Il loop interno contiene load invarianti, espressioni invarianti per
+; tutto il nest o solo per il loop interno, un invariante in un ramo condizionale
+; (hoisting speculativa), una locazione letta e scritta ad ogni iterazione
+; (promozione) e un valore usato solo dopo il loop (sinking).
+; main restituisce un checksum, che deve essere uguale con tutte le configurazioni.
+
+@grid = global [256 x [256 x i32]] zeroinitializer, align 16
+@scale = global i32 3, align 4
+@bias = global i32 11, align 4
+@acc = global i32 0, align 4
+
+define i32 @kernel(i32 %rounds, i32 %k) {
+entry:
+  br label %round
+
+round:
+  %r = phi i32 [ 0, %entry ], [ %r.next, %round.latch ]
+  br label %outer
+
+outer:
+  %i = phi i32 [ 0, %round ], [ %i.next, %outer.latch ]
+  %osum = phi i32 [ 0, %round ], [ %osum.next, %outer.latch ]
+  br label %inner
+
+inner:
+  %j = phi i32 [ 0, %outer ], [ %j.next, %inner.latch ]
+  %sc = load i32, ptr @scale, align 4
+  %bi = load i32, ptr @bias, align 4
+  %kk = mul i32 %k, %sc
+  %kb = add i32 %kk, %bi
+  %row = mul i32 %i, %kb
+  %p = getelementptr inbounds [256 x [256 x i32]], ptr @grid, i32 0, i32 %i, i32 %j
+  %v = load i32, ptr %p, align 4
+  %odd = and i32 %v, 1
+  %isodd = icmp ne i32 %odd, 0
+  br i1 %isodd, label %odd.bb, label %inner.latch
+
+odd.bb:
+  %sq = mul i32 %kb, %kb
+  %q = xor i32 %sq, %row
+  br label %inner.latch
+
+inner.latch:
+  %extra = phi i32 [ %q, %odd.bb ], [ 1, %inner ]
+  %nv = add i32 %v, %row
+  %nv2 = add i32 %nv, %extra
+  store i32 %nv2, ptr %p, align 4
+  %a = load i32, ptr @acc, align 4
+  %a2 = add i32 %a, %nv2
+  store i32 %a2, ptr @acc, align 4
+  %last = mul i32 %j, %kb
+  %j.next = add nuw nsw i32 %j, 1
+  %cj = icmp ult i32 %j.next, 256
+  br i1 %cj, label %inner, label %outer.latch
+
+outer.latch:
+  %osum.next = add i32 %osum, %last
+  %i.next = add nuw nsw i32 %i, 1
+  %ci = icmp ult i32 %i.next, 256
+  br i1 %ci, label %outer, label %round.latch
+
+round.latch:
+  %r.next = add nuw nsw i32 %r, 1
+  %cr = icmp ult i32 %r.next, %rounds
+  br i1 %cr, label %round, label %exit
+
+exit:
+  %res = load i32, ptr @acc, align 4
+  %total = add i32 %res, %osum.next
+  ret i32 %total
+}
+
+define i32 @main() {
+entry:
+  %s = call i32 @kernel(i32 200, i32 5)
+  %res = and i32 %s, 255
+  ret i32 %res
+}
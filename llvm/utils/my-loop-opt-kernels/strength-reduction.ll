@@ -0,0 +1,51 @@
+; Kernel per my-loop-opt-bench.py: moltiplicazioni e divisioni per costante nel body
+; (localopts) e indirizzi calcolati moltiplicando l'induction variable (my-iv-sr).
+; main restituisce un checksum, che deve essere uguale con tutte le configurazioni.
+
+@a = global [4096 x i32] zeroinitializer, align 16
+
+define i32 @kernel(i32 %rounds) {
+entry:
+  br label %outer
+
+outer:
+  %r = phi i32 [ 0, %entry ], [ %r.next, %outer.latch ]
+  %sum = phi i32 [ 0, %entry ], [ %s.next, %outer.latch ]
+  br label %inner
+
+inner:
+  %i = phi i32 [ 0, %outer ], [ %i.next, %inner ]
+  %s = phi i32 [ %sum, %outer ], [ %s.next, %inner ]
+  %x = add i32 %i, %r
+  %m = mul i32 %x, 15
+  %d = udiv i32 %x, 7
+  %rem = urem i32 %x, 10
+  %sd = sdiv i32 %m, 12
+  %t1 = add i32 %m, %d
+  %t2 = add i32 %t1, %rem
+  %t3 = add i32 %t2, %sd
+  %idx = mul i32 %i, 3
+  %p = getelementptr inbounds [4096 x i32], ptr @a, i32 0, i32 %idx
+  %old = load i32, ptr %p, align 4
+  %new = add i32 %old, %t3
+  store i32 %new, ptr %p, align 4
+  %s.next = add i32 %s, %new
+  %i.next = add nuw nsw i32 %i, 1
+  %c = icmp ult i32 %i.next, 1365
+  br i1 %c, label %inner, label %outer.latch
+
+outer.latch:
+  %r.next = add nuw nsw i32 %r, 1
+  %co = icmp ult i32 %r.next, %rounds
+  br i1 %co, label %outer, label %exit
+
+exit:
+  ret i32 %s.next
+}
+
+define i32 @main() {
+entry:
+  %s = call i32 @kernel(i32 20000)
+  %res = and i32 %s, 255
+  ret i32 %res
+}